@@ -0,0 +1,311 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Benchmark of mean_shift_cluster over synthetic Gaussian mixtures. Every
+// combination of scalar type, metric, kernel and thread count selected on
+// the command line is run once and reported as a JSON object per line.
+//
+// Usage: msc_bench [key=value...], with the keys
+//   n, dim, clusters, spread, noise, seed   synthetic data
+//   bandwidth, max_iter                     clustering
+//   scalars, metrics, kernels, threads      comma separated lists to sweep
+
+#include "msc"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <random>
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <functional>
+
+struct Config
+{
+    std::size_t n = 2000;
+    int dim = 3;
+    int clusters = 8;
+    double spread = 1;
+    double noise = 0.05;
+    unsigned seed = 1;
+    double bandwidth = 1;
+    int max_iter = 1000;
+    std::vector<std::string> scalars = {"float", "double"};
+    std::vector<std::string> metrics = {"L2Sq", "L2"};
+    // Empty: the kernels that suit each metric (see default_kernels).
+    std::vector<std::string> kernels;
+    std::vector<int> threads = {1};
+};
+
+// Points around `clusters` centers drawn uniformly in [-10, 10]^dim, with a
+// normal spread, plus a fraction `noise` of points uniform in the same box.
+template <class T>
+std::vector<T> generate(const Config& config)
+{
+    std::mt19937 random(config.seed);
+    std::uniform_real_distribution<double> box(-10, 10);
+    std::normal_distribution<double> normal(0, config.spread);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::uniform_int_distribution<int> pick(0, config.clusters - 1);
+
+    std::vector<double> centers(config.clusters * config.dim);
+    for (auto& c : centers)
+        c = box(random);
+    std::vector<T> points(config.n * config.dim);
+    for (std::size_t i = 0; i < config.n; i++)
+    {
+        T* point = &points[i * config.dim];
+        if (unit(random) < config.noise)
+            for (int k = 0; k < config.dim; k++)
+                point[k] = static_cast<T>(box(random));
+        else
+        {
+            const double* center = &centers[pick(random) * config.dim];
+            for (int k = 0; k < config.dim; k++)
+                point[k] = static_cast<T>(center[k] + normal(random));
+        }
+    }
+    return points;
+}
+
+// Peak resident memory, in kB, since the last reset (where supported).
+void reset_peak_memory()
+{
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+long peak_memory()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+        if (line.compare(0, 6, "VmHWM:") == 0)
+            return std::stol(line.substr(6));
+    return -1;
+}
+
+template <class T, class Metric, class Kernel>
+void run(const Config& config, const std::vector<T>& points,
+    const std::string& scalar, const std::string& metric_name,
+    const std::string& kernel_name, Metric metric, Kernel kernel)
+{
+    const msc::RowIterator<T> first(points.data(), config.dim);
+    const auto last = first + config.n;
+    for (const auto threads : config.threads)
+    {
+        msc::Options options;
+        options.max_iter = config.max_iter;
+        options.threads = threads;
+        msc::Stats stats;
+        reset_peak_memory();
+        const auto t0 = std::chrono::steady_clock::now();
+        const auto clusters = msc::mean_shift_cluster<T>(first, last,
+            config.dim, metric, kernel,
+            msc::estimators::Constant(config.bandwidth),
+            options, msc::neighbors::KDTree(), stats);
+        const auto t1 = std::chrono::steady_clock::now();
+        const auto seconds = std::chrono::duration<double>(t1 - t0).count();
+
+        long total = 0;
+        std::vector<long> histogram;
+        for (const auto count : stats.iterations())
+        {
+            std::size_t bucket = 0;
+            while ((2 << bucket) <= count)
+                bucket++;
+            histogram.resize(std::max(histogram.size(), bucket + 1));
+            histogram[bucket]++;
+            total += count;
+        }
+        const auto& counters = stats.counters();
+
+        std::ostringstream out;
+        out << "{\"n\": " << config.n << ", \"dim\": " << config.dim
+            << ", \"clusters\": " << config.clusters
+            << ", \"spread\": " << config.spread
+            << ", \"noise\": " << config.noise
+            << ", \"seed\": " << config.seed
+            << ", \"bandwidth\": " << config.bandwidth
+            << ", \"scalar\": \"" << scalar << "\""
+            << ", \"metric\": \"" << metric_name << "\""
+            << ", \"kernel\": \"" << kernel_name << "\""
+            << ", \"threads\": " << threads
+            << ", \"seconds\": " << seconds
+            << ", \"seed_iterations\": " << total
+            << ", \"seed_iterations_per_second\": " << total / seconds
+            << ", \"max_iter_hits\": " << counters.max_iter_hits
+            << ", \"kernel_evaluations\": " << counters.evaluations
+            << ", \"zero_weights\": " << counters.zero_weights
+            << ", \"shift_seconds\": " << stats.seconds(msc::Phase::Shift)
+            << ", \"merge_seconds\": " << stats.seconds(msc::Phase::Merge)
+            << ", \"iterations_histogram\": [";
+        for (std::size_t b = 0; b < histogram.size(); b++)
+            out << (b ? ", " : "") << histogram[b];
+        out << "], \"modes\": " << clusters.size()
+            << ", \"peak_memory_kb\": " << peak_memory() << "}";
+        std::cout << out.str() << std::endl;
+    }
+}
+
+// Kernels of squared distances go with L2Sq, and those of distances with
+// the other metrics.
+const std::vector<std::string>& default_kernels(const std::string& metric)
+{
+    static const std::vector<std::string> squared = {"Uniform",
+        "ParabolicSq", "BiweightSq", "TriweightSq", "GaussianSq"};
+    static const std::vector<std::string> plain = {"Uniform", "Parabolic",
+        "Biweight", "Triweight", "Tricube", "Gaussian", "Cosine"};
+    return metric == "L2Sq" ? squared : plain;
+}
+
+template <class T, class Metric>
+void sweep_kernels(const Config& config, const std::vector<T>& points,
+    const std::string& scalar, const std::string& metric_name, Metric metric)
+{
+    namespace kernels = msc::kernels;
+    const std::map<std::string, std::function<void()>> runs = {
+        {"Uniform", [&] { run(config, points, scalar, metric_name,
+            "Uniform", metric, kernels::Uniform()); }},
+        {"Parabolic", [&] { run(config, points, scalar, metric_name,
+            "Parabolic", metric, kernels::Parabolic()); }},
+        {"Biweight", [&] { run(config, points, scalar, metric_name,
+            "Biweight", metric, kernels::Biweight()); }},
+        {"Triweight", [&] { run(config, points, scalar, metric_name,
+            "Triweight", metric, kernels::Triweight()); }},
+        {"Tricube", [&] { run(config, points, scalar, metric_name,
+            "Tricube", metric, kernels::Tricube()); }},
+        {"Gaussian", [&] { run(config, points, scalar, metric_name,
+            "Gaussian", metric, kernels::Gaussian()); }},
+        {"Cosine", [&] { run(config, points, scalar, metric_name,
+            "Cosine", metric, kernels::Cosine()); }},
+        {"ParabolicSq", [&] { run(config, points, scalar, metric_name,
+            "ParabolicSq", metric, kernels::ParabolicSq()); }},
+        {"BiweightSq", [&] { run(config, points, scalar, metric_name,
+            "BiweightSq", metric, kernels::BiweightSq()); }},
+        {"TriweightSq", [&] { run(config, points, scalar, metric_name,
+            "TriweightSq", metric, kernels::TriweightSq()); }},
+        {"GaussianSq", [&] { run(config, points, scalar, metric_name,
+            "GaussianSq", metric, kernels::GaussianSq()); }},
+    };
+    const auto& names = config.kernels.empty() ?
+        default_kernels(metric_name) : config.kernels;
+    for (const auto& kernel : names)
+    {
+        const auto it = runs.find(kernel);
+        if (it == runs.end())
+            throw std::invalid_argument("Unknown kernel " + kernel);
+        it->second();
+    }
+}
+
+template <class T>
+void sweep(const Config& config, const std::string& scalar)
+{
+    const auto points = generate<T>(config);
+    for (const auto& metric : config.metrics)
+    {
+        if (metric == "L2Sq")
+            sweep_kernels(config, points, scalar, metric, msc::metrics::L2Sq());
+        else if (metric == "L2")
+            sweep_kernels(config, points, scalar, metric, msc::metrics::L2());
+        else if (metric == "L1")
+            sweep_kernels(config, points, scalar, metric, msc::metrics::L1());
+        else
+            throw std::invalid_argument("Unknown metric " + metric);
+    }
+}
+
+std::vector<std::string> split(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream in(list);
+    std::string item;
+    while (std::getline(in, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+int main(int argc, char** argv)
+{
+    Config config;
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            const std::string arg = argv[i];
+            const auto eq = arg.find('=');
+            const auto key = arg.substr(0, eq);
+            const auto value = eq == std::string::npos ? "" : arg.substr(eq + 1);
+            if (key == "n")
+                config.n = std::stoul(value);
+            else if (key == "dim")
+                config.dim = std::stoi(value);
+            else if (key == "clusters")
+                config.clusters = std::stoi(value);
+            else if (key == "spread")
+                config.spread = std::stod(value);
+            else if (key == "noise")
+                config.noise = std::stod(value);
+            else if (key == "seed")
+                config.seed = std::stoul(value);
+            else if (key == "bandwidth")
+                config.bandwidth = std::stod(value);
+            else if (key == "max_iter")
+                config.max_iter = std::stoi(value);
+            else if (key == "scalars")
+                config.scalars = split(value);
+            else if (key == "metrics")
+                config.metrics = split(value);
+            else if (key == "kernels")
+                config.kernels = split(value);
+            else if (key == "threads")
+            {
+                config.threads.clear();
+                for (const auto& t : split(value))
+                    config.threads.push_back(std::stoi(t));
+            }
+            else
+                throw std::invalid_argument("Unknown option " + arg);
+        }
+        if (config.dim <= 0 || config.clusters <= 0)
+            throw std::invalid_argument("dim and clusters must be positive");
+
+        for (const auto& scalar : config.scalars)
+        {
+            if (scalar == "float")
+                sweep<float>(config, scalar);
+            else if (scalar == "double")
+                sweep<double>(config, scalar);
+            else
+                throw std::invalid_argument("Unknown scalar " + scalar);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -23,11 +23,17 @@
 #include <vector>
 #include <memory>
 #include <string>
-#include <sstream>
 #include <fstream>
 #include <istream>
 #include <iostream>
 #include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
 
 #ifdef _WIN32
 #include <io.h>
@@ -36,20 +42,83 @@
 #endif
 
 typedef double Scalar;
-typedef std::vector<Scalar> Container;
 
-std::vector<Container> load(std::istream& in, int col_offset = 0);
-void dump(const std::vector<Container>& points,
+// Points read from the input, stored row by row in a single buffer.
+struct Points
+{
+    std::vector<Scalar> data;
+    int dim = 0;
+
+    std::size_t size() const
+    {
+        return dim > 0 ? data.size() / dim : 0;
+    }
+
+    msc::RowIterator<Scalar> begin() const
+    {
+        return msc::RowIterator<Scalar>(data.data(), dim);
+    }
+
+    msc::RowIterator<Scalar> end() const
+    {
+        return begin() + size();
+    }
+};
+
+Points load(std::istream& in, int col_offset = 0);
+void dump(const Points& points,
+    const std::vector<msc::Cluster<Scalar>>& clusters);
+bool dump_binary(const std::string& prefix, const Points& points,
     const std::vector<msc::Cluster<Scalar>>& clusters);
 
+int cluster_mapped(const std::string& filename, double bandwidth,
+    double timeout);
+void print_stats(const msc::Stats& stats);
+
 int main(int argc, char** argv)
 {
-    const double bandwidth = argc > 1 ? std::stof(argv[1]) : 1;
+    bool mapped = false, stats = false;
+    std::string convert, binary;
+    double timeout = 0;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        if (arg == "--mapped")
+            mapped = true;
+        else if (arg == "--stats")
+            stats = true;
+        else if (arg == "--convert" && i + 1 < argc)
+            convert = argv[++i];
+        else if (arg == "--binary" && i + 1 < argc)
+            binary = argv[++i];
+        else if (arg == "--timeout" && i + 1 < argc)
+            timeout = std::stod(argv[++i]);
+        else
+            args.push_back(arg);
+    }
+
+    const double bandwidth = args.size() > 0 ? std::stof(args[0]) : 1;
+    if (mapped)
+    {
+        if (args.size() < 2)
+        {
+            std::cerr << "A point file is needed with --mapped" << std::endl;
+            return 1;
+        }
+        if (stats || !binary.empty() || !convert.empty())
+        {
+            std::cerr << "--stats, --binary and --convert do not apply to "
+                "--mapped" << std::endl;
+            return 1;
+        }
+        return cluster_mapped(args[1], bandwidth, timeout);
+    }
     std::istream* in = &std::cin;
     std::ifstream infile;
-    if (argc > 2)
+    if (args.size() > 1)
     {
-        infile.open(argv[2]);
+        infile.open(args[1]);
         in = &infile;
     }
     else
@@ -67,20 +136,55 @@ int main(int argc, char** argv)
             in = &infile;
         }
     }
-    const int col_offset = argc > 3 ? std::stoi(argv[3]) : 0;
+    const int col_offset = args.size() > 2 ? std::stoi(args[2]) : 0;
 
     std::cerr << "Kernel bandwidth: " << bandwidth << std::endl;
-    const auto points = load(*in, col_offset);
+    Points points;
+    try
+    {
+        points = load(*in, col_offset);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
     std::cerr << "Num. points: " << points.size() << std::endl;
-    if (points.empty())
+    if (points.size() == 0)
+        return 0;
+    if (!convert.empty())
+    {
+        msc::write_points<Scalar>(convert,
+            points.begin(), points.end(), points.dim);
         return 0;
+    }
+    msc::Options options;
+    msc::Control control;
+    if (timeout > 0)
+    {
+        control.set_timeout(timeout);
+        options.control = &control;
+    }
+    msc::Stats run_stats;
     const auto t0 = std::chrono::high_resolution_clock::now();
-    const auto clusters = msc::mean_shift_cluster<Scalar>(
-        std::begin(points), std::end(points), points[0].size(),
+    const auto clusters = stats ? msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), points.dim,
         msc::metrics::L2Sq(),
         msc::kernels::ParabolicSq(),
-        msc::estimators::Constant(bandwidth));
+        msc::estimators::Constant(bandwidth),
+        options,
+        msc::neighbors::KDTree(),
+        run_stats) : msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), points.dim,
+        msc::metrics::L2Sq(),
+        msc::kernels::ParabolicSq(),
+        msc::estimators::Constant(bandwidth),
+        options,
+        msc::neighbors::KDTree());
     const auto t1 = std::chrono::high_resolution_clock::now();
+    if (control.interrupted())
+        std::cerr << "Timed out: clusters of the unconverged trajectories"
+            << std::endl;
     std::cerr << "Clusters (" << clusters.size() << "):" << std::endl;
     for (const auto& cluster : clusters)
     {
@@ -91,42 +195,471 @@ int main(int argc, char** argv)
     }
     std::cerr << "Elapsed time: " << std::chrono::duration_cast<
         std::chrono::microseconds>(t1 - t0).count() / 1e6 << " s" << std::endl;
+    if (stats)
+        print_stats(run_stats);
+    if (!binary.empty())
+        return dump_binary(binary, points, clusters) ? 0 : 1;
     dump(points, clusters);
     return 0;
 }
 
-std::vector<Container> load(std::istream& in, int col_offset)
+// Prints the time of every phase, the iterations per seed (with a histogram
+// of power of two buckets) and the kernel evaluations of a run.
+void print_stats(const msc::Stats& stats)
+{
+    const char* names[] = {"index", "estimator", "seeding", "shift",
+        "merge", "assign"};
+    std::cerr << "Phase times (s):";
+    for (int p = 0; p < 6; p++)
+        std::cerr << " " << names[p] << " "
+            << stats.seconds(static_cast<msc::Phase>(p));
+    std::cerr << std::endl;
+
+    const auto& iterations = stats.iterations();
+    long long total = 0;
+    int max = 0;
+    std::vector<std::size_t> histogram;
+    for (const auto n : iterations)
+    {
+        std::size_t bucket = 0;
+        while ((2 << bucket) <= n)
+            bucket++;
+        histogram.resize(std::max(histogram.size(), bucket + 1));
+        histogram[bucket]++;
+        total += n;
+        max = std::max(max, n);
+    }
+    std::cerr << "Seeds: " << iterations.size() << "; iterations: " << total
+        << " (mean " << (iterations.empty() ? 0. :
+        static_cast<double>(total) / iterations.size())
+        << ", max " << max << ")" << std::endl;
+    std::cerr << "Iterations histogram:";
+    for (std::size_t b = 0; b < histogram.size(); b++)
+        std::cerr << " [" << (1 << b) << ", " << (2 << b) << "): "
+            << histogram[b];
+    std::cerr << std::endl;
+    const auto& counters = stats.counters();
+    std::cerr << "Kernel evaluations: " << counters.evaluations
+        << "; zero weights: " << counters.zero_weights
+        << "; max_iter hits: " << counters.max_iter_hits << std::endl;
+}
+
+// Clusters a point file (see msc.mapped.h) without loading it, and writes
+// the label of every point (as uint32) to <filename>.labels and the modes,
+// as a point file, to <filename>.modes.
+int cluster_mapped(const std::string& filename, double bandwidth,
+    double timeout)
+{
+    const msc::MappedPoints<Scalar> points(filename);
+    std::cerr << "Kernel bandwidth: " << bandwidth << std::endl;
+    std::cerr << "Num. points: " << points.size() << std::endl;
+    std::ofstream labels(filename + ".labels", std::ios::binary);
+    msc::Options options;
+    msc::Control control;
+    if (timeout > 0)
+    {
+        control.set_timeout(timeout);
+        options.control = &control;
+    }
+    const auto t0 = std::chrono::high_resolution_clock::now();
+    const auto modes = msc::mean_shift_cluster_blocked<Scalar>(
+        points.begin(), points.end(), points.dim(),
+        msc::metrics::L2Sq(),
+        msc::kernels::ParabolicSq(),
+        msc::estimators::Constant(bandwidth),
+        options,
+        [&](std::size_t, const std::uint32_t* values, std::size_t n)
+        {
+            labels.write(reinterpret_cast<const char*>(values),
+                n * sizeof(*values));
+        },
+        msc::neighbors::KDTree());
+    const auto t1 = std::chrono::high_resolution_clock::now();
+    if (control.interrupted())
+        std::cerr << "Timed out: modes of the unconverged seeds" << std::endl;
+    msc::write_points<Scalar>(filename + ".modes",
+        modes.begin(), modes.end(), points.dim());
+    std::cerr << "Modes: " << modes.size() << std::endl;
+    std::cerr << "Elapsed time: " << std::chrono::duration_cast<
+        std::chrono::microseconds>(t1 - t0).count() / 1e6 << " s" << std::endl;
+    return labels ? 0 : 1;
+}
+
+namespace
+{
+inline bool is_separator(char c)
+{
+    return c == ' ' || c == '\t' || c == ',' || c == '\r';
+}
+
+// Parses a number like std::strtod does, but without its overhead when the
+// number has at most 19 significant digits and a small exponent, which is
+// then converted exactly. Returns `p` when there is no number.
+const char* parse_number(const char* p, Scalar& value)
+{
+    static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19,
+        1e20, 1e21, 1e22};
+    const char* start = p;
+    const bool negative = *p == '-';
+    if (*p == '-' || *p == '+')
+        p++;
+    std::uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    const char* first = p;
+    for (; *p >= '0' && *p <= '9'; p++)
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa > 0;
+        }
+        else
+            exponent++;
+    }
+    if (*p == '.')
+    {
+        for (p++; *p >= '0' && *p <= '9'; p++)
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa > 0;
+                exponent--;
+            }
+        }
+    }
+    if (p == first || (p == first + 1 && *first == '.'))
+    {
+        char* end;
+        value = std::strtod(start, &end);
+        return end;
+    }
+    if (*p == 'e' || *p == 'E')
+    {
+        const char* q = p + 1;
+        const bool minus = *q == '-';
+        if (*q == '-' || *q == '+')
+            q++;
+        if (*q >= '0' && *q <= '9')
+        {
+            int e = 0;
+            for (; *q >= '0' && *q <= '9'; q++)
+                e = e < 10000 ? e * 10 + (*q - '0') : e;
+            exponent += minus ? -e : e;
+            p = q;
+        }
+    }
+    if (mantissa >= (std::uint64_t(1) << 53) || exponent < -22 || exponent > 22)
+    {
+        char* end;
+        value = std::strtod(start, &end);
+        return end;
+    }
+    value = static_cast<Scalar>(exponent < 0 ?
+        mantissa / powers[-exponent] : mantissa * powers[exponent]);
+    if (negative)
+        value = -value;
+    return p;
+}
+
+// Points of the lines in [begin, end), which must start at a line.
+struct Part
+{
+    std::vector<Scalar> data;
+    int dim = 0;
+};
+
+void parse(const char* begin, const char* end, int col_offset, Part& part)
+{
+    for (const char* line = begin; line < end; )
+    {
+        auto eol = static_cast<const char*>(
+            std::memchr(line, '\n', end - line));
+        if (!eol)
+            eol = end;
+        if (*line != '%')
+        {
+            int values = 0;
+            int skip = col_offset;
+            for (const char* p = line; ; )
+            {
+                while (p < eol && is_separator(*p))
+                    p++;
+                if (p == eol)
+                    break;
+                if (skip > 0)
+                    skip--;
+                else
+                {
+                    Scalar value;
+                    const char* q = parse_number(p, value);
+                    if (q == p)
+                        throw std::runtime_error("Invalid number: " +
+                            std::string(p, std::find_if(p, eol, is_separator)));
+                    part.data.push_back(value);
+                    values++;
+                    p = q;
+                }
+                while (p < eol && !is_separator(*p))
+                    p++;
+            }
+            if (values > 0 && part.dim == 0)
+                part.dim = values;
+            else if (values > 0 && values != part.dim)
+                throw std::runtime_error(
+                    "All the points must have the same dimension");
+        }
+        line = eol + 1;
+    }
+}
+} // namespace
+
+// Reads the whole input in large blocks and parses it in parallel, split at
+// line boundaries. Lines starting with '%' are comments, and the first
+// `col_offset` values of every line are skipped.
+Points load(std::istream& in, int col_offset)
 {
-    std::vector<Container> points;
-    std::string line;
-    while (std::getline(in, line))
-    {
-        if (line[0] == '%')
-            continue;
-        points.emplace_back();
-        auto& point = points.back();
-        std::istringstream lin(line);
-        std::string token;
-        for (int i = 0; i < col_offset; i++)
-            lin >> token;
-        while (lin >> token)
-            point.push_back(std::stod(token));
+    std::vector<char> buffer;
+    const auto start = in.tellg();
+    if (start >= 0 && in.seekg(0, std::ios::end))
+    {
+        buffer.reserve(static_cast<std::size_t>(in.tellg() - start) + 1);
+        in.seekg(start);
+    }
+    in.clear();
+    const std::size_t block = 1 << 24;
+    std::size_t size = 0;
+    while (in)
+    {
+        buffer.resize(size + block);
+        in.read(buffer.data() + size, block);
+        size += static_cast<std::size_t>(in.gcount());
+    }
+    buffer.resize(size);
+    buffer.push_back('\0');
+
+    const std::size_t chunks = 4 * msc::detail::default_threads();
+    std::vector<const char*> bounds(chunks + 1, buffer.data() + size);
+    bounds[0] = buffer.data();
+    for (std::size_t c = 1; c < chunks; c++)
+    {
+        const char* p = buffer.data() + size * c / chunks;
+        p = std::max(p, bounds[c - 1]);
+        if (p > buffer.data())
+            while (p < buffer.data() + size && p[-1] != '\n')
+                p++;
+        bounds[c] = p;
     }
+
+    std::vector<Part> parts(chunks);
+    msc::detail::parallel_for(chunks, 0, 1,
+        [&](std::size_t begin, std::size_t end)
+    {
+        for (auto c = begin; c < end; c++)
+            parse(bounds[c], bounds[c + 1], col_offset, parts[c]);
+    });
+
+    Points points;
+    std::vector<std::size_t> offsets(chunks + 1, 0);
+    for (std::size_t c = 0; c < chunks; c++)
+    {
+        if (parts[c].dim > 0 && points.dim == 0)
+            points.dim = parts[c].dim;
+        else if (parts[c].dim > 0 && parts[c].dim != points.dim)
+            throw std::runtime_error(
+                "All the points must have the same dimension");
+        offsets[c + 1] = offsets[c] + parts[c].data.size();
+    }
+    points.data.resize(offsets[chunks]);
+    msc::detail::parallel_for(chunks, 0, 1,
+        [&](std::size_t begin, std::size_t end)
+    {
+        for (auto c = begin; c < end; c++)
+        {
+            std::copy(parts[c].data.begin(), parts[c].data.end(),
+                points.data.begin() + offsets[c]);
+            std::vector<Scalar>().swap(parts[c].data);
+        }
+    });
     return points;
 }
 
-void dump(const std::vector<Container>& points,
+namespace
+{
+// Buffered writer to the standard output, with a formatting of numbers that
+// matches the default one of the streams (`%g`) without its cost.
+class Writer
+{
+public:
+    Writer() : buffer_(1 << 20), size_(0) {}
+
+    ~Writer()
+    {
+        flush();
+    }
+
+    void put(char c)
+    {
+        if (size_ == buffer_.size())
+            flush();
+        buffer_[size_++] = c;
+    }
+
+    void write(const char* s, std::size_t n)
+    {
+        if (size_ + n > buffer_.size())
+            flush();
+        std::memcpy(&buffer_[size_], s, n);
+        size_ += n;
+    }
+
+    void integer(std::size_t value)
+    {
+        char digits[24];
+        int n = 0;
+        do
+            digits[n++] = static_cast<char>('0' + value % 10);
+        while (value /= 10);
+        std::reverse(digits, digits + n);
+        write(digits, n);
+    }
+
+    void number(double value)
+    {
+        char text[32];
+        write(text, format(value, text));
+    }
+
+    void flush()
+    {
+        std::fwrite(buffer_.data(), 1, size_, stdout);
+        size_ = 0;
+    }
+
+private:
+    // Six significant digits, rounded from the value scaled to [1e5, 1e6),
+    // which is exact unless the scaled value is too close to a rounding tie
+    // or out of the range of exact powers of ten; snprintf does those.
+    static int format(double value, char* text)
+    {
+        static const double powers[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6,
+            1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+            1e18, 1e19, 1e20, 1e21, 1e22};
+        const auto magnitude = std::fabs(value);
+        int e = magnitude > 0 && magnitude < 1e300 ?
+            static_cast<int>(std::floor(std::log10(magnitude))) : 0;
+        std::uint32_t digits = 0;
+        bool exact = magnitude > 0 && e >= -17 && e <= 27;
+        for (int tries = 0; exact && tries < 2; tries++)
+        {
+            const auto scaled = e <= 5 ? magnitude * powers[5 - e] :
+                magnitude / powers[e - 5];
+            const auto whole = std::floor(scaled);
+            exact = std::fabs(scaled - whole - 0.5) > 1e-6;
+            digits = static_cast<std::uint32_t>(whole) +
+                (scaled - whole > 0.5);
+            if (digits >= 1000000)
+                e++;
+            else if (digits < 100000)
+                e--;
+            else
+                break;
+            exact = exact && tries == 0 && e >= -17 && e <= 27;
+        }
+        if (!exact || digits < 100000 || digits >= 1000000)
+            return std::snprintf(text, 32, "%g", value);
+
+        char mantissa[6];
+        for (int k = 5; k >= 0; k--, digits /= 10)
+            mantissa[k] = static_cast<char>('0' + digits % 10);
+        int significant = 6;
+        while (significant > 1 && mantissa[significant - 1] == '0')
+            significant--;
+
+        int n = 0;
+        if (value < 0)
+            text[n++] = '-';
+        if (e < -4 || e >= 6)
+        {
+            text[n++] = mantissa[0];
+            if (significant > 1)
+            {
+                text[n++] = '.';
+                for (int k = 1; k < significant; k++)
+                    text[n++] = mantissa[k];
+            }
+            text[n++] = 'e';
+            text[n++] = e < 0 ? '-' : '+';
+            const int a = e < 0 ? -e : e;
+            text[n++] = static_cast<char>('0' + a / 10);
+            text[n++] = static_cast<char>('0' + a % 10);
+        }
+        else if (e >= 0)
+        {
+            for (int k = 0; k <= e; k++)
+                text[n++] = mantissa[k];
+            if (significant > e + 1)
+            {
+                text[n++] = '.';
+                for (int k = e + 1; k < significant; k++)
+                    text[n++] = mantissa[k];
+            }
+        }
+        else
+        {
+            text[n++] = '0';
+            text[n++] = '.';
+            for (int k = 0; k < -e - 1; k++)
+                text[n++] = '0';
+            for (int k = 0; k < significant; k++)
+                text[n++] = mantissa[k];
+        }
+        return n;
+    }
+
+    std::vector<char> buffer_;
+    std::size_t size_;
+};
+} // namespace
+
+void dump(const Points& points,
     const std::vector<msc::Cluster<Scalar>>& clusters)
 {
+    Writer out;
     for (std::size_t c = 0; c < clusters.size(); c++)
     {
         for (const auto& index : clusters[c].members)
         {
-            const auto& point = points[index];
-            std::cout << c;
-            for (std::size_t k = 0; k < point.size(); k++)
-                std::cout << " " << point[k];
-            std::cout << std::endl;
+            const Scalar* point = points.data.data() + index * points.dim;
+            out.integer(c);
+            for (int k = 0; k < points.dim; k++)
+            {
+                out.put(' ');
+                out.number(point[k]);
+            }
+            out.put('\n');
         }
     }
 }
+
+// Writes the label of every point, in input order, as a uint32 to
+// <prefix>.labels and the modes, as a point file, to <prefix>.modes.
+bool dump_binary(const std::string& prefix, const Points& points,
+    const std::vector<msc::Cluster<Scalar>>& clusters)
+{
+    std::vector<std::uint32_t> labels(points.size());
+    std::vector<const Scalar*> modes;
+    for (std::size_t c = 0; c < clusters.size(); c++)
+    {
+        for (const auto& index : clusters[c].members)
+            labels[index] = static_cast<std::uint32_t>(c);
+        modes.emplace_back(clusters[c].mode.data());
+    }
+    std::ofstream out(prefix + ".labels", std::ios::binary);
+    out.write(reinterpret_cast<const char*>(labels.data()),
+        labels.size() * sizeof(std::uint32_t));
+    msc::write_points<Scalar>(prefix + ".modes",
+        modes.begin(), modes.end(), points.dim);
+    return static_cast<bool>(out);
+}
@@ -28,6 +28,8 @@ namespace msc
 template <class T>
 struct Accessor<T, T>
 {
+    static const int dim = 1;
+
     inline static const T* data(const T& point)
     {
         return &point;
@@ -43,9 +45,20 @@ struct Accessor<T, T*>
     }
 };
 
-template <class T, int N>
+template <class T>
+struct Accessor<T, const T*>
+{
+    inline static const T* data(const T* point)
+    {
+        return point;
+    }
+};
+
+template <class T, std::size_t N>
 struct Accessor<T, std::array<T, N>>
 {
+    static const int dim = static_cast<int>(N);
+
     inline static const T* data(const std::array<T, N>& point)
     {
         return point.data();
@@ -0,0 +1,214 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "msc.h"
+
+#include <cmath>
+#include <mutex>
+#include <vector>
+#include <limits>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+namespace msc
+{
+namespace detail
+{
+// Entropy of the distribution of the points among the clusters.
+template <class T>
+inline double entropy(const std::vector<Cluster<T>>& clusters, std::size_t n)
+{
+    double h = 0;
+    for (const auto& cluster : clusters)
+    {
+        const auto p = static_cast<double>(cluster.members.size()) / n;
+        h -= p * std::log(p);
+    }
+    return h;
+}
+
+// Sample point bandwidths stay those of the input points, since those of
+// the contracting set would shrink with it: they are kept by point id and
+// laid out in the order of the index of every round. Other estimators are
+// evaluated on the current points.
+template <class Estimator, class Index>
+inline void keep_bandwidths(const Estimator&, const Index&,
+    std::vector<double>&) {}
+
+template <class Index>
+inline void keep_bandwidths(const PointBandwidths& bw, const Index& index,
+    std::vector<double>& kept)
+{
+    kept.resize(2 * bw.size);
+    for (std::size_t i = 0; i < bw.size; i++)
+    {
+        kept[index.id(i)] = bw.ibw[i];
+        kept[bw.size + index.id(i)] = bw.weight[i];
+    }
+}
+
+template <class Estimator, class Index>
+inline Estimator round_bandwidths(const Estimator& estimator,
+    const std::vector<double>&, const Index&, std::vector<double>&)
+{
+    return estimator;
+}
+
+template <class Index>
+inline PointBandwidths round_bandwidths(const PointBandwidths& bw,
+    const std::vector<double>& kept, const Index& index,
+    std::vector<double>& storage)
+{
+    storage.resize(2 * bw.size);
+    for (std::size_t i = 0; i < bw.size; i++)
+    {
+        storage[i] = kept[index.id(i)];
+        storage[bw.size + i] = kept[bw.size + index.id(i)];
+    }
+    auto result = bw;
+    result.ibw = storage.data();
+    result.weight = storage.data() + bw.size;
+    return result;
+}
+} // namespace detail
+
+// Blurring mean shift: every round replaces the whole data set by its
+// shifted version, so that the points, and the density estimated from them,
+// contract at once. The rounds shift all points in parallel from one flat
+// buffer into another and swap them. They end when no point moves more than
+// `options.epsilon`, or when the points have collapsed: their grouping at
+// `options.collapse_tolerance` (by default, a thousandth of the bandwidth,
+// in the units of the metric) is the same as in the previous round and no
+// point moved more than that tolerance. The clusters are those groups, with
+// the collapsed positions as modes. Progress is reported once per round, as
+// the most points yet that moved no more than the tolerance in a round, out
+// of all points; a run that ends without interruption reports all of them.
+template <class T, class Acc = double, class ForwardIterator,
+          class Metric, class Kernel, class Estimator,
+          class Neighbors = neighbors::Linear>
+inline std::vector<Cluster<T>> blurring_mean_shift_cluster(
+    ForwardIterator first, ForwardIterator last, int dim,
+    Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options, Neighbors neighbors = Neighbors())
+{
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    const auto n = static_cast<std::size_t>(std::distance(first, last));
+    if (n == 0)
+        return std::vector<Cluster<T>>();
+
+    std::vector<T> current(n * dim), next(n * dim);
+    auto out = current.begin();
+    for (auto it = first; it != last; it++)
+    {
+        const T* pt = Accessor<T, C>::data(*it);
+        out = std::copy(pt, pt + dim, out);
+    }
+
+    const auto layout = detail::resolve_layout<T>(options.layout, metric);
+    std::vector<double> storage, kept, round_storage;
+    const RowIterator<T> input(current.data(), dim);
+    const auto input_index = neighbors.build(pack<T>(input, input + n, dim,
+        layout));
+    const auto initial = detail::sample_points<T>(estimator, input_index,
+        dim, metric, options, storage, 0);
+    detail::keep_bandwidths(initial, input_index, kept);
+    Control* control = options.control;
+    if (control)
+        control->start(n);
+    auto tolerance = options.collapse_tolerance;
+    std::vector<Cluster<T>> clusters;
+    double entropy = -1;
+    std::size_t reported = 0;
+    for (int iter = 0; iter < options.max_iter; iter++)
+    {
+        if (control && control->stop())
+            break;
+        const RowIterator<T> rows(current.data(), dim);
+        const auto index = neighbors.build(pack<T>(rows, rows + n, dim,
+            layout));
+        const auto bandwidths = detail::round_bandwidths(initial, kept,
+            index, round_storage);
+        if (tolerance <= 0)
+            tolerance = 1e-3 / detail::mean_ibw(detail::bandwidth(bandwidths,
+                current.data(), rows, rows + n, dim, metric));
+
+        double moved = 0;
+        std::size_t settled = 0;
+        std::mutex mutex;
+        detail::parallel_for(n, options.threads, options.chunk_size,
+            [&](std::size_t begin, std::size_t end)
+        {
+            NoStats::Counters counters;
+            double local = 0;
+            std::size_t still = 0;
+            for (auto i = begin; i < end; i++)
+            {
+                if (control && control->stop())
+                    break;
+                const T* pt = &current[i * dim];
+                T* shifted = &next[i * dim];
+                detail::shift_point<Acc>(pt, rows, rows + n, dim,
+                    metric, kernel, bandwidths, index, shifted, counters);
+                const auto d = metric(pt, shifted, dim);
+                local = std::max(local, d);
+                still += d <= tolerance;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            moved = std::max(moved, local);
+            settled += still;
+        });
+        // An interrupted round leaves the points where they were.
+        if (control && control->interrupted())
+            break;
+        if (control && settled > reported)
+        {
+            control->advance(settled - reported);
+            reported = settled;
+        }
+        current.swap(next);
+        if (moved <= options.epsilon)
+        {
+            clusters.clear();
+            break;
+        }
+
+        clusters = detail::cluster(current.data(), n,
+            static_cast<std::size_t>(dim), dim, metric, tolerance,
+            options.threads);
+        const auto h = detail::entropy(clusters, n);
+        if (moved <= tolerance && std::abs(h - entropy) < 1e-8)
+            break;
+        entropy = h;
+        clusters.clear();
+    }
+    if (control && !control->interrupted() && reported < n)
+        control->advance(n - reported);
+    if (clusters.empty())
+        clusters = detail::cluster(current.data(), n,
+            static_cast<std::size_t>(dim), dim, metric,
+            tolerance > 0 ? tolerance : options.epsilon, options.threads);
+    return clusters;
+}
+} // namespace msc
@@ -0,0 +1,314 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "msc.h"
+#include "msc.accessors.h"
+#include "msc.estimators.h"
+#include "msc.neighbors.h"
+
+#include <vector>
+#include <limits>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+namespace msc
+{
+// Keeps a set of points clustered while points are inserted and removed.
+// After every update only the seeds whose trajectory came within the kernel
+// support of a changed point are shifted again; the others keep their mode.
+// Every point is a seed, and the members of the clusters are the current
+// positions of the points. Of the options, only `epsilon`, `max_iter`,
+// `layout`, `threads` and `chunk_size` are used; bin seeding, absorption,
+// blocks and collapsing do not apply, and since neither per-point weights nor
+// an interrupted update could be kept consistent across updates, `weights`
+// and `control` must not be set.
+template <class T, class Metric, class Kernel, class Estimator,
+          class Neighbors = neighbors::Linear, class Acc = double>
+class Clusterer
+{
+public:
+    inline Clusterer(int dim, Metric metric, Kernel kernel,
+        Estimator estimator, const Options& options = Options(),
+        Neighbors neighbors = Neighbors())
+        : dim_(dim), metric_(metric), kernel_(kernel), estimator_(estimator),
+          options_(options), neighbors_(neighbors),
+          min_ibw_(std::numeric_limits<double>::infinity())
+    {
+        if (dim <= 0)
+            throw std::invalid_argument("Dimension must be greater than 0");
+        if (options.weights)
+            throw std::invalid_argument("Clusterer does not support weights");
+        if (options.control)
+            throw std::invalid_argument("Clusterer does not support control");
+    }
+
+    inline std::size_t size() const
+    {
+        return points_.size() / dim_;
+    }
+
+    inline const T* point(std::size_t i) const
+    {
+        return &points_[i * dim_];
+    }
+
+    inline const std::vector<Cluster<T>>& clusters() const
+    {
+        return clusters_;
+    }
+
+    template <class ForwardIterator>
+    inline const std::vector<Cluster<T>>& insert(
+        ForwardIterator first, ForwardIterator last)
+    {
+        typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+        const auto n = size();
+        for (auto it = first; it != last; it++)
+        {
+            const T* pt = Accessor<T, C>::data(*it);
+            points_.insert(points_.end(), pt, pt + dim_);
+        }
+        std::vector<T> changed(points_.begin() + n * dim_, points_.end());
+        shifted_.resize(points_.size());
+        lo_.resize(points_.size());
+        hi_.resize(points_.size());
+        ibw_.resize(size());
+        std::vector<char> stale(size(), 0);
+        std::fill(stale.begin() + n, stale.end(), 1);
+        update(changed, stale);
+        return clusters_;
+    }
+
+    // Removes the points at the given positions. The remaining points keep
+    // their relative order.
+    inline const std::vector<Cluster<T>>& remove(std::vector<std::size_t> ids)
+    {
+        std::sort(ids.begin(), ids.end());
+        ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+        if (!ids.empty() && ids.back() >= size())
+            throw std::out_of_range("Point index out of range");
+
+        std::vector<T> changed;
+        std::size_t kept = 0;
+        for (std::size_t i = 0, r = 0; i < size(); i++)
+        {
+            if (r < ids.size() && ids[r] == i)
+            {
+                changed.insert(changed.end(), point(i), point(i) + dim_);
+                r++;
+                continue;
+            }
+            for (int k = 0; k < dim_; k++)
+            {
+                points_[kept * dim_ + k] = points_[i * dim_ + k];
+                shifted_[kept * dim_ + k] = shifted_[i * dim_ + k];
+                lo_[kept * dim_ + k] = lo_[i * dim_ + k];
+                hi_[kept * dim_ + k] = hi_[i * dim_ + k];
+            }
+            ibw_[kept] = ibw_[i];
+            kept++;
+        }
+        points_.resize(kept * dim_);
+        shifted_.resize(kept * dim_);
+        lo_.resize(kept * dim_);
+        hi_.resize(kept * dim_);
+        ibw_.resize(kept);
+        std::vector<char> stale(kept, 0);
+        update(changed, stale);
+        return clusters_;
+    }
+
+private:
+    typedef decltype(std::declval<Neighbors>().build(
+        std::declval<Matrix<T>>())) Index;
+
+    inline void update(std::vector<T>& changed, std::vector<char>& stale)
+    {
+        const auto n = size();
+        rows_.resize(n);
+        for (std::size_t i = 0; i < n; i++)
+            rows_[i] = point(i);
+        clusters_.clear();
+        if (n == 0)
+            return;
+
+        const auto layout = detail::resolve_layout<T>(options_.layout, metric_);
+        const auto index = neighbors_.build(
+            pack<T>(rows_.begin(), rows_.end(), dim_, layout));
+        std::vector<double> storage;
+        const auto bandwidths = detail::sample_points<T>(estimator_, index,
+            dim_, metric_, options_, storage, 0);
+        mark(changed, reach(bandwidths, index, changed), stale);
+        converge(bandwidths, index, stale);
+        clusters_ = detail::cluster(shifted_.data(), n,
+            static_cast<std::size_t>(dim_), dim_, metric_, options_.epsilon,
+            options_.threads);
+    }
+
+    // Half-width of the region around a changed point where seeds have to
+    // be shifted again. Points whose own bandwidth changed count as changed.
+    inline double reach(const PointBandwidths& bandwidths,
+        const Index& index, std::vector<T>& changed)
+    {
+        for (std::size_t j = 0; j < bandwidths.size; j++)
+        {
+            const auto i = index.id(j);
+            if (ibw_[i] != bandwidths.ibw[j])
+            {
+                changed.insert(changed.end(), point(i), point(i) + dim_);
+                ibw_[i] = bandwidths.ibw[j];
+            }
+        }
+        const auto ibw = std::min(min_ibw_, bandwidths.min_ibw);
+        min_ibw_ = bandwidths.min_ibw;
+        return search_radius(metric_, kernel_, ibw);
+    }
+
+    template <class E>
+    inline double reach(const E& estimator, const Index&,
+        const std::vector<T>&)
+    {
+        if (!estimators::is_constant<E>::value)
+            return std::numeric_limits<double>::infinity();
+        return search_radius(metric_, kernel_, estimator(rows_[0],
+            rows_.begin(), rows_.end(), dim_, metric_));
+    }
+
+    inline void mark(const std::vector<T>& changed, double radius,
+        std::vector<char>& stale) const
+    {
+        if (radius == std::numeric_limits<double>::infinity())
+        {
+            std::fill(stale.begin(), stale.end(), 1);
+            return;
+        }
+        if (changed.empty())
+            return;
+
+        std::vector<const T*> rows;
+        for (std::size_t c = 0; c < changed.size(); c += dim_)
+            rows.emplace_back(&changed[c]);
+        const auto tree = neighbors::KDTree().build(
+            pack<T>(rows.begin(), rows.end(), dim_));
+        const auto& points = tree.points();
+        std::vector<T> center(dim_);
+        detail::parallel_for(stale.size(), options_.threads,
+            options_.chunk_size,
+            [=, &points, &tree, &stale](std::size_t begin, std::size_t end)
+            mutable
+        {
+            for (auto i = begin; i < end; i++)
+            {
+                if (stale[i])
+                    continue;
+                const T* lo = &lo_[i * dim_];
+                const T* hi = &hi_[i * dim_];
+                double half = 0;
+                for (int k = 0; k < dim_; k++)
+                {
+                    center[k] = lo[k] + (hi[k] - lo[k]) / 2;
+                    half = std::max(half, static_cast<double>(hi[k] - lo[k]) / 2);
+                }
+                tree.query(center.data(), half + radius,
+                    [&](std::size_t b, std::size_t e)
+                {
+                    for (auto j = b; j < e && !stale[i]; j++)
+                    {
+                        int k = 0;
+                        for (; k < dim_; k++)
+                            if (points(j, k) < lo[k] - radius ||
+                                points(j, k) > hi[k] + radius)
+                                break;
+                        if (k == dim_)
+                            stale[i] = 1;
+                    }
+                });
+            }
+        });
+    }
+
+    template <class Bandwidths>
+    inline void converge(const Bandwidths& bandwidths, const Index& index,
+        const std::vector<char>& stale)
+    {
+        std::vector<std::size_t> seeds;
+        for (std::size_t i = 0; i < stale.size(); i++)
+            if (stale[i])
+                seeds.emplace_back(i);
+
+        std::vector<T> next(dim_);
+        detail::parallel_for(seeds.size(), options_.threads,
+            options_.chunk_size,
+            [=, &seeds, &index](std::size_t begin, std::size_t end) mutable
+        {
+            for (auto s = begin; s < end; s++)
+            {
+                const auto i = seeds[s];
+                T* pt = &shifted_[i * dim_];
+                T* lo = &lo_[i * dim_];
+                T* hi = &hi_[i * dim_];
+                for (int k = 0; k < dim_; k++)
+                    pt[k] = lo[k] = hi[k] = points_[i * dim_ + k];
+                int iter = 0;
+                double d = 0;
+                do
+                {
+                    mean_shift<Acc>(pt, rows_.begin(), rows_.end(), dim_,
+                        metric_, kernel_, bandwidths, index, next.data());
+                    d = metric_(pt, next.data(), dim_);
+                    for (int k = 0; k < dim_; k++)
+                    {
+                        pt[k] = next[k];
+                        lo[k] = std::min(lo[k], pt[k]);
+                        hi[k] = std::max(hi[k], pt[k]);
+                    }
+                    iter++;
+                }
+                while (d > options_.epsilon && iter < options_.max_iter);
+            }
+        });
+    }
+
+    int dim_;
+    Metric metric_;
+    Kernel kernel_;
+    Estimator estimator_;
+    Options options_;
+    Neighbors neighbors_;
+    std::vector<T> points_, shifted_, lo_, hi_;
+    std::vector<double> ibw_;
+    double min_ibw_;
+    std::vector<const T*> rows_;
+    std::vector<Cluster<T>> clusters_;
+};
+
+template <class T, class Acc = double, class Metric, class Kernel,
+          class Estimator, class Neighbors = neighbors::Linear>
+inline Clusterer<T, Metric, Kernel, Estimator, Neighbors, Acc> make_clusterer(
+    int dim, Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options = Options(), Neighbors neighbors = Neighbors())
+{
+    return Clusterer<T, Metric, Kernel, Estimator, Neighbors, Acc>(
+        dim, metric, kernel, estimator, options, neighbors);
+}
+} // namespace msc
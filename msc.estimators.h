@@ -20,7 +20,13 @@
 
 #pragma once
 
+#include "msc.h"
+
 #include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
 
 namespace msc
 {
@@ -42,6 +48,14 @@ private:
     double factor_;
 };
 
+// Whether an estimator gives the same bandwidth everywhere, whatever the
+// data, so that a shift only depends on the points around it.
+template <class Estimator>
+struct is_constant : std::false_type {};
+
+template <>
+struct is_constant<Constant> : std::true_type {};
+
 struct MinMaxDistance
 {
     inline explicit MinMaxDistance(double factor)
@@ -68,5 +82,83 @@ struct MinMaxDistance
 private:
     double factor_;
 };
+
+// Sample point estimator: the bandwidth of each data point is `factor` times
+// its distance to the k-th nearest neighbor. It is evaluated once per point,
+// before iterating, and kept for all the steps.
+struct KNearest
+{
+    inline explicit KNearest(std::size_t k, double factor = 1)
+        : k_(k), factor_(factor) {}
+
+    // State kept from one point to the next by the caller: search boxes grow
+    // from the radius found for the previous point, which is usually close
+    // by in index order.
+    template <class T>
+    struct Search
+    {
+        double radius = std::numeric_limits<double>::infinity();
+        std::vector<double> nearest;
+        std::vector<T> row;
+    };
+
+    template <class T, class Index, class Dim, class Metric>
+    inline double sample_point(const T* point, const Index& index, Dim dim,
+        Metric metric) const
+    {
+        Search<T> search;
+        return sample_point(point, index, dim, metric, search);
+    }
+
+    template <class T, class Index, class Dim, class Metric>
+    inline double sample_point(const T* point, const Index& index, Dim dim,
+        Metric metric, Search<T>& search) const
+    {
+        auto& radius = search.radius;
+        auto& nearest = search.nearest;
+        auto& row = search.row;
+        const auto& points = index.points();
+        row.resize(dim);
+        for (;;)
+        {
+            nearest.clear();
+            index.query(point, radius, [&](std::size_t begin, std::size_t end)
+            {
+                for (auto i = begin; i < end; i++)
+                {
+                    const T* pt = row.data();
+                    if (points.layout() == Layout::RowMajor)
+                        pt = points.row(i);
+                    else
+                        for (int k = 0; k < dim; k++)
+                            row[k] = points(i, k);
+                    // The point itself is among the k + 1 nearest.
+                    nearest.emplace_back(metric(pt, point, dim));
+                    std::push_heap(nearest.begin(), nearest.end());
+                    if (nearest.size() > k_ + 1)
+                    {
+                        std::pop_heap(nearest.begin(), nearest.end());
+                        nearest.pop_back();
+                    }
+                }
+            });
+            const auto d = nearest.empty() ? 0 : nearest.front();
+            const auto bound = detail::metric_bound(metric, d, 0);
+            if ((nearest.size() == k_ + 1 && bound <= radius) ||
+                radius == std::numeric_limits<double>::infinity())
+            {
+                if (bound > 0)
+                    radius = bound;
+                return 1 / (factor_ * d);
+            }
+            radius = radius > 0 ? 2 * radius :
+                std::numeric_limits<double>::infinity();
+        }
+    }
+
+private:
+    std::size_t k_;
+    double factor_;
+};
 } // namespace estimators
 } // namespace msc
@@ -0,0 +1,437 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "msc.h"
+#include "msc.metrics.h"
+#include "msc.kernels.h"
+
+#include <cmath>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+namespace msc
+{
+namespace detail
+{
+inline std::uint64_t next_index_serial()
+{
+    static std::atomic<std::uint64_t> serial(0);
+    return ++serial;
+}
+} // namespace detail
+
+namespace neighbors
+{
+// Improved fast Gauss transform (Yang, Duraiswami and Raykar). The sums of
+// a step with the Gaussian kernel, over L2Sq (`GaussianSq`) or over L2
+// (`Gaussian`), come from truncated Taylor expansions of the kernel around
+// the centers of a farthest-point clustering of the points. The expansions
+// drop the clusters farther than a cutoff radius, and every sum is then off
+// by at most `epsilon` per point: the total weight by `epsilon * n`, and the
+// weighted coordinates, taken relative to the cluster centers, by
+// `epsilon * n * r`, with `r` the radius of the clusters. The expansion for
+// a bandwidth is built at its first step, with the number of clusters and
+// the truncation order of least estimated cost, and falls back to the exact
+// sums when that cost is not below theirs. Other kernels, metrics or
+// variable bandwidths visit every point, as with the linear scan.
+template <class T>
+class FGTIndex
+{
+public:
+    inline FGTIndex(Matrix<T> points, double epsilon)
+        : points_(std::move(points)), epsilon_(epsilon),
+          serial_(detail::next_index_serial()), cache_(new Cache())
+    {
+        if (!(epsilon_ > 0 && epsilon_ < 1))
+            throw std::invalid_argument("Epsilon must be between 0 and 1");
+    }
+
+    inline const Matrix<T>& points() const
+    {
+        return points_;
+    }
+
+    inline std::size_t id(std::size_t i) const
+    {
+        return i;
+    }
+
+    template <class Function>
+    inline void query(const T*, double, Function f) const
+    {
+        f(std::size_t(0), points_.size());
+    }
+
+    template <class Acc>
+    inline bool transform(const T* point, double ibw, metrics::L2Sq,
+        kernels::GaussianSq, Acc* sums, Acc& total_weight) const
+    {
+        return evaluate(point, 2 / ibw, sums, total_weight);
+    }
+
+    template <class Acc>
+    inline bool transform(const T* point, double ibw, metrics::L2,
+        kernels::Gaussian, Acc* sums, Acc& total_weight) const
+    {
+        return evaluate(point, 2 / (ibw * ibw), sums, total_weight);
+    }
+
+private:
+    // Expansions for the kernel exp(-|x - y|^2 / h2): `terms` coefficients
+    // per cluster for every multi-index of degree below `order`, each for
+    // the weight and for the coordinates relative to the center.
+    struct Expansion
+    {
+        double h2;
+        bool exact;
+        int order;
+        std::size_t terms;
+        double cutoff2;
+        std::vector<double> centers;
+        std::vector<double> coefficients;
+    };
+
+    struct Cache
+    {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<const Expansion>> expansions;
+    };
+
+    template <class Acc>
+    inline bool evaluate(const T* point, double h2, Acc* sums,
+        Acc& total_weight) const
+    {
+        if (!(h2 > 0) || h2 == std::numeric_limits<double>::infinity())
+            return false;
+        const auto& e = expansion(h2);
+        if (e.exact)
+            return false;
+
+        const auto dim = points_.dim();
+        const auto h = std::sqrt(h2);
+        static thread_local std::vector<double> dy, monomials, g;
+        dy.resize(dim);
+        monomials.resize(e.terms);
+        g.resize(dim + 1);
+        const auto clusters = e.centers.size() / dim;
+        for (std::size_t k = 0; k < clusters; k++)
+        {
+            const double* center = &e.centers[k * dim];
+            double d2 = 0;
+            for (int j = 0; j < dim; j++)
+            {
+                dy[j] = point[j] - center[j];
+                d2 += dy[j] * dy[j];
+            }
+            if (d2 > e.cutoff2)
+                continue;
+            for (int j = 0; j < dim; j++)
+                dy[j] /= h;
+            expand(dy.data(), dim, e.order, monomials.data());
+            std::fill(g.begin(), g.end(), 0.);
+            const double* c = &e.coefficients[k * e.terms * (dim + 1)];
+            for (std::size_t a = 0; a < e.terms; a++, c += dim + 1)
+                for (int m = 0; m <= dim; m++)
+                    g[m] += c[m] * monomials[a];
+            const auto w = std::exp(-d2 / h2);
+            total_weight += w * g[0];
+            for (int j = 0; j < dim; j++)
+                sums[j] += w * (g[j + 1] + center[j] * g[0]);
+        }
+        return true;
+    }
+
+    inline const Expansion& expansion(double h2) const
+    {
+        // The expansions live as long as the cache of the index, which is
+        // shared by its copies, and the serial tells the indices apart.
+        struct Last
+        {
+            std::uint64_t serial;
+            const Expansion* expansion;
+        };
+        static thread_local Last last = {0, nullptr};
+        if (last.serial == serial_ && last.expansion->h2 == h2)
+            return *last.expansion;
+
+        std::lock_guard<std::mutex> lock(cache_->mutex);
+        auto& expansions = cache_->expansions;
+        auto it = std::find_if(expansions.begin(), expansions.end(),
+            [=](const std::shared_ptr<const Expansion>& e)
+            { return e->h2 == h2; });
+        if (it == expansions.end())
+            it = expansions.insert(expansions.end(),
+                std::make_shared<const Expansion>(build(h2)));
+        last.serial = serial_;
+        last.expansion = it->get();
+        return **it;
+    }
+
+    // Monomials v^alpha of degree below `order`, in graded order: those of
+    // every degree come from those of the previous one, multiplied by each
+    // coordinate from the one they last used on.
+    static inline std::size_t expand(const double* v, int dim, int order,
+        double* monomials, std::vector<int>* alphas = nullptr)
+    {
+        static thread_local std::vector<std::size_t> heads;
+        heads.assign(dim, 0);
+        monomials[0] = 1;
+        if (alphas)
+            alphas->assign(dim, 0);
+        std::size_t t = 1;
+        for (int degree = 1; degree < order; degree++)
+        {
+            const auto tail = t;
+            for (int i = 0; i < dim; i++)
+            {
+                const auto head = heads[i];
+                heads[i] = t;
+                for (auto j = head; j < tail; j++, t++)
+                {
+                    monomials[t] = v[i] * monomials[j];
+                    if (alphas)
+                    {
+                        for (int q = 0; q < dim; q++)
+                        {
+                            const auto a = (*alphas)[j * dim + q];
+                            alphas->push_back(a + (q == i));
+                        }
+                    }
+                }
+            }
+        }
+        return t;
+    }
+
+    static inline std::size_t terms(int dim, int order)
+    {
+        // Multi-indices of dimension `dim` and degree below `order`.
+        double c = 1;
+        for (int i = 1; i <= dim; i++)
+            c = c * (order - 1 + i) / i;
+        return static_cast<std::size_t>(c + 0.5);
+    }
+
+    static inline double distance2(const double* a, const double* b, int dim)
+    {
+        double d = 0;
+        for (int j = 0; j < dim; j++)
+            d += (a[j] - b[j]) * (a[j] - b[j]);
+        return d;
+    }
+
+    // Farthest-point clustering of the rows of `x` into at most `k`
+    // clusters; the first centers are those of any smaller `k`. Records the
+    // radius of the clustering after each new center when `radii` is given.
+    static inline void cluster(const std::vector<double>& x, int dim,
+        std::size_t k, std::vector<double>& centers,
+        std::vector<std::size_t>& owner, std::vector<double>* radii)
+    {
+        const auto n = x.size() / dim;
+        owner.assign(n, 0);
+        centers.assign(x.begin(), x.begin() + dim);
+        std::vector<double> d2(n);
+        for (std::size_t i = 0; i < n; i++)
+            d2[i] = distance2(&x[i * dim], centers.data(), dim);
+        for (;;)
+        {
+            const auto far = static_cast<std::size_t>(
+                std::max_element(d2.begin(), d2.end()) - d2.begin());
+            if (radii)
+                radii->push_back(std::sqrt(d2[far]));
+            const auto c = centers.size() / dim;
+            if (c == k || d2[far] == 0)
+                break;
+            centers.insert(centers.end(), &x[far * dim],
+                &x[far * dim] + dim);
+            const double* center = &centers[c * dim];
+            for (std::size_t i = 0; i < n; i++)
+            {
+                const auto d = distance2(&x[i * dim], center, dim);
+                if (d < d2[i])
+                {
+                    d2[i] = d;
+                    owner[i] = c;
+                }
+            }
+        }
+    }
+
+    inline Expansion build(double h2) const
+    {
+        const auto n = points_.size();
+        const auto dim = points_.dim();
+        Expansion e;
+        e.h2 = h2;
+        e.exact = true;
+        e.order = 0;
+        e.terms = 0;
+        e.cutoff2 = 0;
+        if (n == 0)
+            return e;
+
+        std::vector<double> x(n * dim);
+        for (std::size_t i = 0; i < n; i++)
+            for (int j = 0; j < dim; j++)
+                x[i * dim + j] = points_(i, j);
+
+        // Cost per step, in multiply-adds, of doubling numbers of clusters
+        // against that of the exact sums. The clusters within the cutoff
+        // are counted around a sample of the points.
+        const auto h = std::sqrt(h2);
+        const auto cutoff = h * std::sqrt(std::log(1 / epsilon_));
+        const auto kmax = std::min<std::size_t>(n,
+            2 * static_cast<std::size_t>(std::sqrt(double(n))) + 1);
+        std::vector<double> centers, radii;
+        std::vector<std::size_t> owner;
+        cluster(x, dim, kmax, centers, owner, &radii);
+        const std::size_t samples = std::min<std::size_t>(n, 64);
+        double best = static_cast<double>(n) * (dim + 2);
+        std::size_t best_k = 0;
+        const int max_order = 64;
+        for (std::size_t k = 1; k <= radii.size();
+            k = k < radii.size() ? std::min(2 * k, radii.size()) : k + 1)
+        {
+            const auto rx = radii[k - 1];
+            const auto ry = rx + cutoff;
+            const auto s = 2 * rx * ry / h2;
+            double bound = 1;
+            int order = 0;
+            while (order < max_order && bound > epsilon_)
+                bound *= s / ++order;
+            if (bound > epsilon_)
+                continue;
+            order = std::max(order, 1);
+            const auto t = terms(dim, order);
+            std::size_t near = 0;
+            for (std::size_t j = 0; j < samples; j++)
+                for (std::size_t c = 0; c < k; c++)
+                    near += distance2(&x[j * n / samples * dim],
+                        &centers[c * dim], dim) <= ry * ry;
+            const auto cost = static_cast<double>(near) / samples *
+                (dim + t * (dim + 2)) + static_cast<double>(t) * dim;
+            if (cost < best && k * t * (dim + 1) <= (std::size_t(1) << 26))
+            {
+                best = cost;
+                best_k = k;
+                e.order = order;
+                e.terms = t;
+                e.cutoff2 = ry * ry;
+            }
+        }
+        if (best_k == 0)
+            return e;
+
+        e.exact = false;
+        cluster(x, dim, best_k, e.centers, owner, nullptr);
+        const auto k = e.centers.size() / dim;
+        std::vector<std::size_t> members(n), offsets(k + 1, 0);
+        for (std::size_t i = 0; i < n; i++)
+            offsets[owner[i] + 1]++;
+        for (std::size_t c = 0; c < k; c++)
+            offsets[c + 1] += offsets[c];
+        {
+            auto next = offsets;
+            for (std::size_t i = 0; i < n; i++)
+                members[next[owner[i]]++] = i;
+        }
+
+        // Coefficients 2^|alpha| / alpha! of the multi-indices.
+        std::vector<int> alphas;
+        std::vector<double> factors(e.terms), zero(dim, 0.);
+        expand(zero.data(), dim, e.order, factors.data(), &alphas);
+        for (std::size_t a = 0; a < e.terms; a++)
+        {
+            factors[a] = 1;
+            for (int j = 0; j < dim; j++)
+                for (int q = 1; q <= alphas[a * dim + j]; q++)
+                    factors[a] *= 2. / q;
+        }
+
+        e.coefficients.assign(k * e.terms * (dim + 1), 0);
+        detail::parallel_for(k, 0, 1, [&](std::size_t begin, std::size_t end)
+        {
+            std::vector<double> dx(dim), offset(dim), monomials(e.terms);
+            for (auto c = begin; c < end; c++)
+            {
+                const double* center = &e.centers[c * dim];
+                double* coefficients =
+                    &e.coefficients[c * e.terms * (dim + 1)];
+                for (auto m = offsets[c]; m < offsets[c + 1]; m++)
+                {
+                    const auto i = members[m];
+                    double d2 = 0;
+                    for (int j = 0; j < dim; j++)
+                    {
+                        offset[j] = x[i * dim + j] - center[j];
+                        dx[j] = offset[j] / h;
+                        d2 += offset[j] * offset[j];
+                    }
+                    const auto w = std::exp(-d2 / h2);
+                    expand(dx.data(), dim, e.order, monomials.data());
+                    double* out = coefficients;
+                    for (std::size_t a = 0; a < e.terms; a++, out += dim + 1)
+                    {
+                        const auto v = w * monomials[a];
+                        out[0] += v;
+                        for (int j = 0; j < dim; j++)
+                            out[j + 1] += v * offset[j];
+                    }
+                }
+                double* out = coefficients;
+                for (std::size_t a = 0; a < e.terms; a++)
+                    for (int m = 0; m <= dim; m++)
+                        *out++ *= factors[a];
+            }
+        });
+        return e;
+    }
+
+    Matrix<T> points_;
+    double epsilon_;
+    std::uint64_t serial_;
+    std::shared_ptr<Cache> cache_;
+};
+
+struct FGT
+{
+    inline explicit FGT(double epsilon = 1e-6)
+        : epsilon_(epsilon) {}
+
+    template <class T>
+    inline FGTIndex<T> build(Matrix<T> points) const
+    {
+        return FGTIndex<T>(std::move(points), epsilon_);
+    }
+
+private:
+    double epsilon_;
+};
+} // namespace neighbors
+} // namespace msc
@@ -20,16 +20,34 @@
 
 #pragma once
 
+#include <cmath>
 #include <vector>
 #include <limits>
 #include <iterator>
 #include <type_traits>
 #include <stdexcept>
+#include <utility>
+#include <functional>
+#include <unordered_map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include <new>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
 
 #ifdef _OPENMP
 #include <omp.h>
 #endif
 
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
 namespace msc
 {
 template <class T>
@@ -42,88 +60,1669 @@ struct Cluster
         : mode(mode, mode + dim), members() {}
 };
 
-template <class T, class C>
-struct Accessor
+template <class T, class C>
+struct Accessor
+{
+    inline static const T* data(const C& point)
+    {
+        static_assert(False<T>::value, "Accessor not implemented for container");
+    }
+
+private:
+    template <class>
+    struct False : std::false_type {};
+};
+
+// Dimension of a container type known at compile time, as given by an
+// Accessor with a `dim` constant, or 0.
+template <class T, class C, class = void>
+struct static_dim : std::integral_constant<int, 0> {};
+
+template <class T, class C>
+struct static_dim<T, C, typename std::enable_if<
+    (Accessor<T, C>::dim > 0)>::type>
+    : std::integral_constant<int, Accessor<T, C>::dim> {};
+
+enum class Layout
+{
+    Auto,
+    RowMajor,
+    ColMajor
+};
+
+template <class T, std::size_t Alignment = 64>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template <class U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    inline AlignedAllocator() {}
+
+    template <class U>
+    inline AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    inline T* allocate(std::size_t n)
+    {
+        if (n == 0)
+            return nullptr;
+        void* p = nullptr;
+        #ifdef _WIN32
+        p = _aligned_malloc(n * sizeof(T), Alignment);
+        #else
+        if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0)
+            p = nullptr;
+        #endif
+        if (!p)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    inline void deallocate(T* p, std::size_t)
+    {
+        #ifdef _WIN32
+        _aligned_free(p);
+        #else
+        std::free(p);
+        #endif
+    }
+
+    template <class U>
+    inline bool operator==(const AlignedAllocator<U, Alignment>&) const
+    {
+        return true;
+    }
+
+    template <class U>
+    inline bool operator!=(const AlignedAllocator<U, Alignment>&) const
+    {
+        return false;
+    }
+};
+
+// Points packed in a single 64-byte aligned buffer. Row-major matrices keep
+// the coordinates of each point together; column-major ones keep each
+// coordinate together, with every column padded to the alignment. `Auto`
+// falls back to row-major here; the clustering functions resolve it.
+template <class T>
+class Matrix
+{
+public:
+    inline Matrix()
+        : data_(), size_(0), dim_(0), ld_(0), layout_(Layout::RowMajor) {}
+
+    inline Matrix(std::size_t size, int dim,
+        Layout layout = Layout::RowMajor)
+        : data_(), size_(size), dim_(dim), ld_(),
+          layout_(layout == Layout::ColMajor ? layout : Layout::RowMajor)
+    {
+        if (dim <= 0)
+            throw std::invalid_argument("Dimension must be greater than 0");
+        const std::size_t lanes = 64 / sizeof(T) > 0 ? 64 / sizeof(T) : 1;
+        ld_ = layout_ == Layout::RowMajor
+            ? static_cast<std::size_t>(dim)
+            : (size + lanes - 1) / lanes * lanes;
+        data_.resize(layout_ == Layout::RowMajor ? size * dim : ld_ * dim);
+    }
+
+    inline std::size_t size() const
+    {
+        return size_;
+    }
+
+    inline int dim() const
+    {
+        return dim_;
+    }
+
+    inline std::size_t ld() const
+    {
+        return ld_;
+    }
+
+    inline Layout layout() const
+    {
+        return layout_;
+    }
+
+    inline T* data()
+    {
+        return data_.data();
+    }
+
+    inline const T* data() const
+    {
+        return data_.data();
+    }
+
+    inline T* row(std::size_t i)
+    {
+        return data_.data() + i * ld_;
+    }
+
+    inline const T* row(std::size_t i) const
+    {
+        return data_.data() + i * ld_;
+    }
+
+    inline T* col(int k)
+    {
+        return data_.data() + k * ld_;
+    }
+
+    inline const T* col(int k) const
+    {
+        return data_.data() + k * ld_;
+    }
+
+    inline T& operator()(std::size_t i, int k)
+    {
+        return layout_ == Layout::RowMajor
+            ? data_[i * ld_ + k] : data_[k * ld_ + i];
+    }
+
+    inline const T& operator()(std::size_t i, int k) const
+    {
+        return layout_ == Layout::RowMajor
+            ? data_[i * ld_ + k] : data_[k * ld_ + i];
+    }
+
+private:
+    std::vector<T, AlignedAllocator<T>> data_;
+    std::size_t size_;
+    int dim_;
+    std::size_t ld_;
+    Layout layout_;
+};
+
+template <class T, class ForwardIterator>
+inline Matrix<T> pack(ForwardIterator first, ForwardIterator last, int dim,
+    Layout layout = Layout::RowMajor)
+{
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+    Matrix<T> points(std::distance(first, last), dim, layout);
+    std::size_t i = 0;
+    for (auto it = first; it != last; it++, i++)
+    {
+        const T* pt = Accessor<T, C>::data(*it);
+        for (int k = 0; k < dim; k++)
+            points(i, k) = pt[k];
+    }
+    return points;
+}
+
+// Random access iterator over the rows (as `const T*`) of a flat row-major
+// array.
+template <class T>
+class RowIterator
+{
+public:
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef const T* value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const T* const* pointer;
+    typedef const T* reference;
+
+    inline RowIterator() : row_(nullptr), dim_(0) {}
+    inline RowIterator(const T* row, std::size_t dim)
+        : row_(row), dim_(dim) {}
+
+    inline reference operator*() const { return row_; }
+    inline reference operator[](difference_type n) const
+    {
+        return row_ + n * static_cast<difference_type>(dim_);
+    }
+    inline RowIterator& operator++() { row_ += dim_; return *this; }
+    inline RowIterator& operator--() { row_ -= dim_; return *this; }
+    inline RowIterator operator++(int) { auto it = *this; ++*this; return it; }
+    inline RowIterator operator--(int) { auto it = *this; --*this; return it; }
+    inline RowIterator& operator+=(difference_type n)
+    {
+        row_ += n * static_cast<difference_type>(dim_);
+        return *this;
+    }
+    inline RowIterator& operator-=(difference_type n) { return *this += -n; }
+    inline RowIterator operator+(difference_type n) const
+    {
+        auto it = *this;
+        return it += n;
+    }
+    inline RowIterator operator-(difference_type n) const
+    {
+        auto it = *this;
+        return it -= n;
+    }
+    inline difference_type operator-(const RowIterator& other) const
+    {
+        return (row_ - other.row_) / static_cast<difference_type>(dim_);
+    }
+    inline bool operator==(const RowIterator& other) const
+    {
+        return row_ == other.row_;
+    }
+    inline bool operator!=(const RowIterator& other) const
+    {
+        return row_ != other.row_;
+    }
+    inline bool operator<(const RowIterator& other) const
+    {
+        return row_ < other.row_;
+    }
+
+private:
+    const T* row_;
+    std::size_t dim_;
+};
+
+// Cooperative control of a run, handed to it through `Options::control`.
+// The run can be cancelled from any thread or given a deadline, both checked
+// at every iteration of every seed, and reports its progress (seeds finished
+// out of the total) once per chunk of seeds, one call at a time. A stopped run
+// still returns the trajectories as they stand, each point that the merging
+// has not settled in a cluster of its own, and is then `interrupted()`. A cancellation stays until `reset()`, so that one sent
+// just before a run starts still stops it; a Control is reused by resetting
+// it between runs.
+class Control
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::function<void(std::size_t, std::size_t)> Progress;
+
+    Control() : cancelled_(false), interrupted_(false), deadline_(never()),
+        done_(0), total_(0) {}
+
+    void cancel()
+    {
+        cancelled_ = true;
+    }
+
+    // The deadline is kept in clock ticks so that it can be moved while a
+    // run is checking it.
+    void set_deadline(Clock::time_point deadline)
+    {
+        deadline_.store(deadline.time_since_epoch().count(),
+            std::memory_order_relaxed);
+    }
+
+    void set_timeout(double seconds)
+    {
+        set_deadline(Clock::now() + std::chrono::duration_cast<
+            Clock::duration>(std::chrono::duration<double>(seconds)));
+    }
+
+    // Clears the cancellation, the deadline and the interruption, keeping
+    // the progress callback. Not to be called during a run.
+    void reset()
+    {
+        cancelled_ = false;
+        interrupted_ = false;
+        deadline_.store(never(), std::memory_order_relaxed);
+    }
+
+    void set_progress(Progress progress)
+    {
+        progress_ = progress;
+    }
+
+    bool interrupted() const
+    {
+        return interrupted_;
+    }
+
+    // Interface of the run.
+    void start(std::size_t total)
+    {
+        interrupted_ = false;
+        done_ = 0;
+        total_ = total;
+    }
+
+    // The clock is only read while a deadline is set.
+    bool stop()
+    {
+        if (interrupted_.load(std::memory_order_relaxed))
+            return true;
+        const auto deadline = deadline_.load(std::memory_order_relaxed);
+        if (cancelled_.load(std::memory_order_relaxed) ||
+            (deadline != never() &&
+            Clock::now().time_since_epoch().count() >= deadline))
+            interrupted_ = true;
+        return interrupted_.load(std::memory_order_relaxed);
+    }
+
+    void advance(std::size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ += n;
+        if (progress_)
+            progress_(done_, total_);
+    }
+
+private:
+    static Clock::rep never()
+    {
+        return Clock::time_point::max().time_since_epoch().count();
+    }
+
+    std::atomic<bool> cancelled_, interrupted_;
+    std::atomic<Clock::rep> deadline_;
+    Progress progress_;
+    std::size_t done_, total_;
+    std::mutex mutex_;
+};
+
+struct Options
+{
+    double epsilon = std::numeric_limits<float>::epsilon();
+    int max_iter = std::numeric_limits<int>::max();
+    bool bin_seeding = false;
+    double bin_size = 0;
+    std::size_t min_bin_freq = 1;
+    double absorb_tolerance = 0;
+    Layout layout = Layout::Auto;
+    int threads = 0;
+    std::size_t chunk_size = 0;
+    std::size_t block_size = 1 << 20;
+    std::size_t cached_points = 1 << 22;
+    double collapse_tolerance = 0;
+    const double* weights = nullptr;
+    Control* control = nullptr;
+};
+
+// Phases of a clustering run, as reported to its observer.
+enum class Phase { Index, Estimator, Seeding, Shift, Merge, Assign };
+
+// Observer that collects nothing; all of its hooks compile out.
+struct NoStats
+{
+    struct Counters
+    {
+        void evaluated(std::size_t) {}
+        void weight(double) {}
+        void capped() {}
+    };
+
+    void start(Phase) {}
+    void stop(Phase) {}
+    void seeds(std::size_t) {}
+    void seed(std::size_t, int) {}
+    void merge(const Counters&) {}
+};
+
+// Observer that collects the time spent in every phase, the iterations of
+// every seed and the kernel evaluations, counting those of zero weight and
+// the seeds stopped by `max_iter`. The counters are kept by every thread
+// and merged once per chunk of seeds.
+class Stats
+{
+public:
+    struct Counters
+    {
+        std::size_t evaluations = 0;
+        std::size_t zero_weights = 0;
+        std::size_t max_iter_hits = 0;
+
+        void evaluated(std::size_t n) { evaluations += n; }
+        void weight(double w) { zero_weights += w == 0; }
+        void capped() { max_iter_hits++; }
+    };
+
+    Stats() : seconds_() {}
+
+    void start(Phase phase)
+    {
+        started_[index(phase)] = Clock::now();
+    }
+
+    void stop(Phase phase)
+    {
+        seconds_[index(phase)] += std::chrono::duration<double>(
+            Clock::now() - started_[index(phase)]).count();
+    }
+
+    void seeds(std::size_t n)
+    {
+        iterations_.assign(n, 0);
+    }
+
+    void seed(std::size_t i, int iterations)
+    {
+        iterations_[i] = iterations;
+    }
+
+    void merge(const Counters& counters)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        counters_.evaluations += counters.evaluations;
+        counters_.zero_weights += counters.zero_weights;
+        counters_.max_iter_hits += counters.max_iter_hits;
+    }
+
+    double seconds(Phase phase) const { return seconds_[index(phase)]; }
+    const std::vector<int>& iterations() const { return iterations_; }
+    const Counters& counters() const { return counters_; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static std::size_t index(Phase phase)
+    {
+        return static_cast<std::size_t>(phase);
+    }
+
+    Clock::time_point started_[6];
+    double seconds_[6];
+    std::vector<int> iterations_;
+    Counters counters_;
+    std::mutex mutex_;
+};
+
+namespace detail
+{
+template <class Kernel>
+inline auto kernel_support(const Kernel& kernel, int)
+    -> decltype(kernel.support())
+{
+    return kernel.support();
+}
+
+template <class Kernel>
+inline double kernel_support(const Kernel&, long)
+{
+    return std::numeric_limits<double>::infinity();
+}
+
+template <class Kernel>
+inline auto kernel_batch(const Kernel& kernel, double* w, std::size_t n, int)
+    -> decltype(kernel.batch(w, w, n))
+{
+    kernel.batch(w, w, n);
+}
+
+template <class Kernel>
+inline void kernel_batch(const Kernel& kernel, double* w, std::size_t n, long)
+{
+    for (std::size_t j = 0; j < n; j++)
+        w[j] = kernel(w[j]);
+}
+
+template <class Metric>
+inline auto metric_bound(const Metric& metric, double d, int)
+    -> decltype(metric.bound(d))
+{
+    return metric.bound(d);
+}
+
+template <class Metric>
+inline double metric_bound(const Metric&, double, long)
+{
+    return std::numeric_limits<double>::infinity();
+}
+} // namespace detail
+
+// Whether the metric has a `batch` member computing the distances from a
+// column-major block of points to a query.
+template <class Metric, class T>
+struct has_batch
+{
+private:
+    template <class M>
+    static auto test(int) -> decltype(std::declval<const M&>().batch(
+        std::declval<const T*>(), std::declval<const T*>(), std::size_t(),
+        std::size_t(), 0, std::declval<double*>()), std::true_type());
+
+    template <class>
+    static std::false_type test(long);
+
+public:
+    static const bool value = decltype(test<Metric>(0))::value;
+};
+
+namespace detail
+{
+// The column-major layout only pays off with the vectorized `batch` of
+// msc.metrics.h; built without AVX2 or AVX-512, the row-major one is as fast
+// or faster at every dimension.
+template <class T, class Metric>
+inline Layout resolve_layout(Layout layout, const Metric&)
+{
+    if (layout != Layout::Auto)
+        return layout;
+#if defined(__AVX512F__) || (defined(__AVX2__) && defined(__FMA__))
+    return has_batch<Metric, T>::value ? Layout::ColMajor : Layout::RowMajor;
+#else
+    return Layout::RowMajor;
+#endif
+}
+} // namespace detail
+
+// Half-width of the axis-aligned box around a query outside of which every
+// point gets a zero weight. Infinite unless the kernel has a compact
+// `support()` and the metric can `bound()` coordinate differences.
+template <class Metric, class Kernel>
+inline double search_radius(const Metric& metric, const Kernel& kernel,
+    double ibw)
+{
+    const auto support = detail::kernel_support(kernel, 0);
+    if (support == std::numeric_limits<double>::infinity())
+        return support;
+    return detail::metric_bound(metric, support / ibw, 0);
+}
+
+// Inverse bandwidths fixed per point of a neighbor index (in index order),
+// with the weight that normalizes the kernel of each point. They are computed
+// once, before iterating, from a sample point estimator.
+struct PointBandwidths
+{
+    const double* ibw;
+    const double* weight;
+    std::size_t size;
+    double min_ibw;
+};
+
+namespace detail
+{
+template <class Estimator, class T, class ForwardIterator, class Dim,
+          class Metric>
+inline double bandwidth(const Estimator& estimator, const T* point,
+    ForwardIterator first, ForwardIterator last, Dim dim, Metric metric)
+{
+    return estimator(point, first, last, dim, metric);
+}
+
+template <class T, class ForwardIterator, class Dim, class Metric>
+inline const PointBandwidths& bandwidth(const PointBandwidths& bandwidths,
+    const T*, ForwardIterator, ForwardIterator, Dim, Metric)
+{
+    return bandwidths;
+}
+
+inline double min_ibw(double ibw) { return ibw; }
+inline double min_ibw(const PointBandwidths& bw) { return bw.min_ibw; }
+
+inline double point_ibw(double ibw, std::size_t) { return ibw; }
+inline double point_ibw(const PointBandwidths& bw, std::size_t i)
+{
+    return bw.ibw[i];
+}
+
+inline double point_weight(double, std::size_t, double w) { return w; }
+inline double point_weight(const PointBandwidths& bw, std::size_t i,
+    double w)
+{
+    return w * bw.weight[i];
+}
+
+inline double mean_ibw(double ibw) { return ibw; }
+inline double mean_ibw(const PointBandwidths& bw)
+{
+    double sum = 0;
+    for (std::size_t i = 0; i < bw.size; i++)
+        sum += 1 / bw.ibw[i];
+    return bw.size / sum;
+}
+
+inline void point_weights(double, std::size_t, double*, std::size_t) {}
+inline void point_weights(const PointBandwidths& bw, std::size_t begin,
+    double* w, std::size_t n)
+{
+    for (std::size_t j = 0; j < n; j++)
+        w[j] *= bw.weight[begin + j];
+}
+
+// An estimator, or its bandwidths, along with the weights of the points in
+// the order of the index.
+template <class Bandwidth>
+struct Weighted
+{
+    Bandwidth bandwidth;
+    const double* weight;
+};
+
+template <class Estimator, class T, class ForwardIterator, class Dim,
+          class Metric>
+inline auto bandwidth(const Weighted<Estimator>& weighted, const T* point,
+    ForwardIterator first, ForwardIterator last, Dim dim, Metric metric)
+    -> Weighted<typename std::decay<decltype(bandwidth(weighted.bandwidth,
+        point, first, last, dim, metric))>::type>
+{
+    typedef typename std::decay<decltype(bandwidth(weighted.bandwidth,
+        point, first, last, dim, metric))>::type Bandwidth;
+    Weighted<Bandwidth> result = {bandwidth(weighted.bandwidth,
+        point, first, last, dim, metric), weighted.weight};
+    return result;
+}
+
+template <class Bandwidth>
+inline double min_ibw(const Weighted<Bandwidth>& bw)
+{
+    return min_ibw(bw.bandwidth);
+}
+
+template <class Bandwidth>
+inline double point_ibw(const Weighted<Bandwidth>& bw, std::size_t i)
+{
+    return point_ibw(bw.bandwidth, i);
+}
+
+template <class Bandwidth>
+inline double point_weight(const Weighted<Bandwidth>& bw, std::size_t i,
+    double w)
+{
+    return bw.weight[i] * point_weight(bw.bandwidth, i, w);
+}
+
+template <class Bandwidth>
+inline double mean_ibw(const Weighted<Bandwidth>& bw)
+{
+    return mean_ibw(bw.bandwidth);
+}
+
+template <class Bandwidth>
+inline void point_weights(const Weighted<Bandwidth>& bw, std::size_t begin,
+    double* w, std::size_t n)
+{
+    point_weights(bw.bandwidth, begin, w, n);
+    for (std::size_t j = 0; j < n; j++)
+        w[j] *= bw.weight[begin + j];
+}
+
+// The weights of `options.weights`, given in input order, in index order.
+template <class Index>
+inline std::vector<double> index_weights(const Index& index,
+    const double* weights)
+{
+    std::vector<double> result(index.points().size());
+    for (std::size_t i = 0; i < result.size(); i++)
+        result[i] = weights[index.id(i)];
+    return result;
+}
+} // namespace detail
+
+namespace neighbors
+{
+template <class T>
+class LinearIndex
+{
+public:
+    inline explicit LinearIndex(Matrix<T> points)
+        : points_(std::move(points)) {}
+
+    inline const Matrix<T>& points() const
+    {
+        return points_;
+    }
+
+    inline std::size_t id(std::size_t i) const
+    {
+        return i;
+    }
+
+    template <class Function>
+    inline void query(const T*, double, Function f) const
+    {
+        f(std::size_t(0), points_.size());
+    }
+
+private:
+    Matrix<T> points_;
+};
+
+struct Linear
+{
+    template <class T>
+    inline LinearIndex<T> build(Matrix<T> points) const
+    {
+        return LinearIndex<T>(std::move(points));
+    }
+};
+} // namespace neighbors
+
+template <class T, class ForwardIterator,
+          class Metric, class Kernel, class Estimator>
+inline std::vector<T> mean_shift(const T* point,
+    ForwardIterator first, ForwardIterator last, int dim,
+    Metric metric, Kernel kernel, Estimator estimator)
+{
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+
+    std::vector<T> shifted(dim);
+    const auto ibw = estimator(point, first, last, dim, metric);
+    double total_weight = 0;
+
+    for (auto it = first; it != last; it++)
+    {
+        const T* pt = Accessor<T, C>::data(*it);
+        const auto dist = metric(pt, point, dim);
+        const auto weight = kernel(dist * ibw);
+        for (std::size_t k = 0; k < shifted.size(); k++)
+            shifted[k] += pt[k] * weight;
+        total_weight += weight;
+    }
+
+    for (std::size_t k = 0; k < shifted.size(); k++)
+        shifted[k] /= total_weight;
+
+    return shifted;
+}
+
+// Accumulation type that keeps the rounding error of a double (or float) sum,
+// after Neumaier's improvement of Kahan's summation.
+template <class T>
+struct Compensated
+{
+    inline Compensated(T value = 0)
+        : sum(value), error(0) {}
+
+    inline Compensated& operator+=(T x)
+    {
+        const T t = sum + x;
+        if (std::abs(sum) >= std::abs(x))
+            error += (sum - t) + x;
+        else
+            error += (x - t) + sum;
+        sum = t;
+        return *this;
+    }
+
+    inline operator T() const
+    {
+        return sum + error;
+    }
+
+    T sum, error;
+};
+
+namespace detail
+{
+// Reductions over four independent partial sums, so that they pipeline (and
+// vectorize) without reassociating the whole loop.
+inline double sum(const double* a, std::size_t n)
+{
+    double s[4] = {0, 0, 0, 0};
+    std::size_t j = 0;
+    for (; j + 4 <= n; j += 4)
+        for (int l = 0; l < 4; l++)
+            s[l] += a[j + l];
+    for (; j < n; j++)
+        s[0] += a[j];
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+template <class T>
+inline double dot(const T* a, const double* b, std::size_t n)
+{
+    double s[4] = {0, 0, 0, 0};
+    std::size_t j = 0;
+    for (; j + 4 <= n; j += 4)
+        for (int l = 0; l < 4; l++)
+            s[l] += a[j + l] * b[j + l];
+    for (; j < n; j++)
+        s[0] += a[j] * b[j];
+    return (s[0] + s[1]) + (s[2] + s[3]);
+}
+
+template <class T, class Dim, class Metric, class Kernel, class Bandwidth,
+          class Acc, class Counters>
+inline void accumulate(const T* point, const Matrix<T>& points,
+    std::size_t begin, std::size_t end, Dim dim, Metric metric, Kernel kernel,
+    const Bandwidth& bw, Acc* shifted, Acc& total_weight, Counters& counters,
+    std::false_type)
+{
+    counters.evaluated(end - begin);
+    if (points.layout() == Layout::RowMajor)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            const T* pt = points.row(i);
+            const auto weight = point_weight(bw, i,
+                kernel(metric(pt, point, dim) * point_ibw(bw, i)));
+            counters.weight(weight);
+            for (int k = 0; k < dim; k++)
+                shifted[k] += pt[k] * weight;
+            total_weight += weight;
+        }
+        return;
+    }
+    static thread_local std::vector<T> row;
+    row.resize(dim);
+    for (auto i = begin; i < end; i++)
+    {
+        for (int k = 0; k < dim; k++)
+            row[k] = points.col(k)[i];
+        const auto weight = point_weight(bw, i,
+            kernel(metric(row.data(), point, dim) * point_ibw(bw, i)));
+        counters.weight(weight);
+        for (int k = 0; k < dim; k++)
+            shifted[k] += row[k] * weight;
+        total_weight += weight;
+    }
+}
+
+template <class T, class Dim, class Metric, class Kernel, class Bandwidth,
+          class Acc, class Counters>
+inline void accumulate(const T* point, const Matrix<T>& points,
+    std::size_t begin, std::size_t end, Dim dim, Metric metric, Kernel kernel,
+    const Bandwidth& bw, Acc* shifted, Acc& total_weight, Counters& counters,
+    std::true_type)
+{
+    if (points.layout() == Layout::RowMajor)
+    {
+        accumulate(point, points, begin, end, dim, metric, kernel, bw,
+            shifted, total_weight, counters, std::false_type());
+        return;
+    }
+    counters.evaluated(end - begin);
+    const std::size_t block = 64;
+    double weights[block];
+    for (auto b = begin; b < end; b += block)
+    {
+        const auto n = std::min(block, end - b);
+        metric.batch(point, points.data() + b, points.ld(), n, dim, weights);
+        for (std::size_t j = 0; j < n; j++)
+            weights[j] *= point_ibw(bw, b + j);
+        kernel_batch(kernel, weights, n, 0);
+        point_weights(bw, b, weights, n);
+        for (std::size_t j = 0; j < n; j++)
+            counters.weight(weights[j]);
+        total_weight += sum(weights, n);
+        for (int k = 0; k < dim; k++)
+            shifted[k] += dot(points.col(k) + b, weights, n);
+    }
+}
+
+// Indices with a `transform` member for the kernel, metric and bandwidth
+// compute the sums of a step themselves (see msc.fgt.h), or return false to
+// leave them to the query.
+template <class Index, class T, class Bandwidth, class Metric, class Kernel,
+          class Acc>
+inline auto transform(const Index& index, const T* point, const Bandwidth& bw,
+    Metric metric, Kernel kernel, Acc* sums, Acc& total_weight, int)
+    -> decltype(index.transform(point, bw, metric, kernel, sums,
+        total_weight))
+{
+    return index.transform(point, bw, metric, kernel, sums, total_weight);
+}
+
+template <class Index, class T, class Bandwidth, class Metric, class Kernel,
+          class Acc>
+inline bool transform(const Index&, const T*, const Bandwidth&,
+    Metric, Kernel, Acc*, Acc&, long)
+{
+    return false;
+}
+
+template <class Acc, class T, class ForwardIterator, class Dim,
+          class Index, class Metric, class Kernel, class Estimator,
+          class Counters>
+inline void shift_point(const T* point,
+    ForwardIterator first, ForwardIterator last, Dim dim,
+    Metric metric, Kernel kernel, const Estimator& estimator,
+    const Index& index, T* shifted, Counters& counters)
+{
+    const auto& bw = detail::bandwidth(estimator, point, first, last, dim,
+        metric);
+    const auto radius = search_radius(metric, kernel, detail::min_ibw(bw));
+    const auto& points = index.points();
+    static thread_local std::vector<Acc> sums;
+    sums.assign(dim, Acc());
+    Acc total_weight = 0;
+
+    if (!transform(index, point, bw, metric, kernel, sums.data(),
+        total_weight, 0))
+    {
+        index.query(point, radius, [&](std::size_t begin, std::size_t end)
+        {
+            detail::accumulate(point, points, begin, end, dim, metric,
+                kernel, bw, sums.data(), total_weight, counters,
+                std::integral_constant<bool, has_batch<Metric, T>::value>());
+        });
+    }
+
+    for (int k = 0; k < dim; k++)
+        shifted[k] = static_cast<T>(static_cast<double>(sums[k]) /
+            static_cast<double>(total_weight));
+}
+} // namespace detail
+
+// The sums are kept in `Acc`, which may be wider than the point type.
+template <class Acc = double, class T, class ForwardIterator, class Dim,
+          class Index, class Metric, class Kernel, class Estimator>
+inline void mean_shift(const T* point,
+    ForwardIterator first, ForwardIterator last, Dim dim,
+    Metric metric, Kernel kernel, Estimator estimator, const Index& index,
+    T* shifted)
+{
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    NoStats::Counters counters;
+    detail::shift_point<Acc>(point, first, last, dim, metric, kernel,
+        estimator, index, shifted, counters);
+}
+
+template <class T, class ForwardIterator, class Index,
+          class Metric, class Kernel, class Estimator>
+inline std::vector<T> mean_shift(const T* point,
+    ForwardIterator first, ForwardIterator last, int dim,
+    Metric metric, Kernel kernel, Estimator estimator, const Index& index)
+{
+    std::vector<T> shifted(dim > 0 ? dim : 0);
+    mean_shift(point, first, last, dim, metric, kernel, estimator, index,
+        shifted.data());
+    return shifted;
+}
+
+namespace detail
+{
+struct CellHash
+{
+    inline std::size_t operator()(const std::vector<long long>& key) const
+    {
+        std::size_t h = 0;
+        for (const auto& k : key)
+            h = h * 1000003u ^ std::hash<long long>()(k);
+        return h;
+    }
+};
+
+// Grid cells crossed by finished trajectories, each mapped to the seed that
+// holds the mode it led to. Shared by all threads through striped locks.
+class Basins
 {
-    inline static const T* data(const C& point)
+public:
+    inline Basins(int dim, double cell_size)
+        : stripes_(64), dim_(dim), cell_size_(cell_size) {}
+
+    template <class T>
+    inline void cell(const T* point, long long* key) const
     {
-        static_assert(False<T>::value, "Accessor not implemented for container");
+        for (int k = 0; k < dim_; k++)
+            key[k] = static_cast<long long>(std::floor(point[k] / cell_size_));
+    }
+
+    inline bool find(const std::vector<long long>& key, std::size_t& owner) const
+    {
+        auto& stripe = stripes_[CellHash()(key) % stripes_.size()];
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        const auto it = stripe.cells.find(key);
+        if (it == stripe.cells.end())
+            return false;
+        owner = it->second;
+        return true;
+    }
+
+    inline void insert(const std::vector<long long>& path,
+        std::vector<long long>& key, std::size_t owner)
+    {
+        for (std::size_t p = 0; p < path.size(); p += dim_)
+        {
+            key.assign(path.begin() + p, path.begin() + p + dim_);
+            auto& stripe = stripes_[CellHash()(key) % stripes_.size()];
+            std::lock_guard<std::mutex> lock(stripe.mutex);
+            stripe.cells.emplace(key, owner);
+        }
     }
 
 private:
-    template <class>
-    struct False : std::false_type {};
+    struct Stripe
+    {
+        std::mutex mutex;
+        std::unordered_map<std::vector<long long>, std::size_t,
+            CellHash> cells;
+    };
+
+    mutable std::vector<Stripe> stripes_;
+    int dim_;
+    double cell_size_;
 };
 
-template <class T, class ForwardIterator,
-          class Metric, class Kernel, class Estimator>
-inline std::vector<T> mean_shift(const T* point,
-    ForwardIterator first, ForwardIterator last, int dim,
-    Metric metric, Kernel kernel, Estimator estimator)
+inline int default_threads()
 {
-    if (dim <= 0)
-        throw std::invalid_argument("Dimension must be greater than 0");
-    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+#endif
+}
 
-    std::vector<T> shifted(dim);
-    const auto ibw = estimator(point, first, last, dim, metric);
-    double total_weight = 0;
+// Runs task(begin, end) over chunks of [0, n) on a pool of std::threads. Each
+// thread starts with an even share of the chunks and, once it runs out, steals
+// half of the chunks left to another thread. Every thread works on its own
+// copy of the task, so per-thread buffers can be kept in it.
+template <class Task>
+inline void parallel_for(std::size_t n, int threads, std::size_t chunk_size,
+    const Task& task)
+{
+    if (threads <= 0)
+        threads = default_threads();
+    if (chunk_size == 0)
+        chunk_size = std::max<std::size_t>(1, n / (64 * threads));
+    const auto chunks = (n + chunk_size - 1) / chunk_size;
+    threads = static_cast<int>(std::min<std::size_t>(threads, chunks));
+    if (threads <= 1)
+    {
+        auto local = task;
+        for (std::size_t begin = 0; begin < n; begin += chunk_size)
+            local(begin, std::min(n, begin + chunk_size));
+        return;
+    }
 
-    for (auto it = first; it != last; it++)
+    struct Queue
     {
-        const T* pt = Accessor<T, C>::data(*it);
-        const auto dist = metric(pt, point, dim);
-        const auto weight = kernel(dist * ibw);
-        for (std::size_t k = 0; k < shifted.size(); k++)
-            shifted[k] += pt[k] * weight;
-        total_weight += weight;
+        std::mutex mutex;
+        std::size_t begin, end;
+    };
+    std::vector<Queue> queues(threads);
+    for (int t = 0; t < threads; t++)
+    {
+        queues[t].begin = chunks * t / threads;
+        queues[t].end = chunks * (t + 1) / threads;
     }
 
-    for (std::size_t k = 0; k < shifted.size(); k++)
-        shifted[k] /= total_weight;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto work = [&](int t)
+    {
+        auto local = task;
+        for (;;)
+        {
+            std::size_t c = chunks;
+            {
+                std::lock_guard<std::mutex> lock(queues[t].mutex);
+                if (queues[t].begin < queues[t].end)
+                    c = queues[t].begin++;
+            }
+            for (int v = 1; c == chunks && v < threads; v++)
+            {
+                auto& victim = queues[(t + v) % threads];
+                std::size_t begin = 0, end = 0;
+                {
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    const auto left = victim.end - victim.begin;
+                    if (left == 0)
+                        continue;
+                    end = victim.end;
+                    begin = victim.end -= (left + 1) / 2;
+                }
+                std::lock_guard<std::mutex> lock(queues[t].mutex);
+                c = begin;
+                queues[t].begin = begin + 1;
+                queues[t].end = end;
+            }
+            if (c == chunks)
+                return;
+            try
+            {
+                local(c * chunk_size, std::min(n, (c + 1) * chunk_size));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+    };
 
-    return shifted;
+    std::vector<std::thread> pool;
+    pool.reserve(threads - 1);
+    for (int t = 1; t < threads; t++)
+        pool.emplace_back(work, t);
+    work(0);
+    for (auto& thread : pool)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
 }
 
-template <class T, class ForwardIterator,
-          class Metric, class Kernel, class Estimator>
-inline std::vector<std::vector<T>> mean_shift(
-    ForwardIterator first, ForwardIterator last, int dim,
+// Runs a sample point estimator once over the indexed points, keeping the
+// inverse bandwidths and kernel weights in `storage`. Any other estimator is
+// returned as is, to be evaluated at every step.
+// A sample point estimator may declare a `Search<T>` that it is handed
+// along with every point, to keep state from one point to the next. Every
+// thread has its own.
+struct NoSearch {};
+
+template <class T, class Estimator>
+inline auto sample_search(const Estimator&, int)
+    -> typename Estimator::template Search<T>
+{
+    return typename Estimator::template Search<T>();
+}
+
+template <class T, class Estimator>
+inline NoSearch sample_search(const Estimator&, long)
+{
+    return NoSearch();
+}
+
+template <class T, class Estimator, class Index, class Dim, class Metric,
+          class Search>
+inline auto sample_point(const Estimator& estimator, const T* point,
+    const Index& index, Dim dim, Metric metric, Search& search, int)
+    -> decltype(estimator.sample_point(point, index, dim, metric, search))
+{
+    return estimator.sample_point(point, index, dim, metric, search);
+}
+
+template <class T, class Estimator, class Index, class Dim, class Metric,
+          class Search>
+inline double sample_point(const Estimator& estimator, const T* point,
+    const Index& index, Dim dim, Metric metric, Search&, long)
+{
+    return estimator.sample_point(point, index, dim, metric);
+}
+
+template <class T, class Estimator, class Index, class Dim, class Metric>
+inline auto sample_points(const Estimator& estimator, const Index& index,
+    Dim dim, Metric metric, const Options& options,
+    std::vector<double>& storage, int)
+    -> decltype((void)estimator.sample_point(
+        static_cast<const T*>(nullptr), index, dim, metric), PointBandwidths())
+{
+    const auto& points = index.points();
+    const auto n = points.size();
+    storage.assign(2 * n, 0);
+    double* ibw = storage.data();
+    double* weight = ibw + n;
+    std::vector<T> row(dim);
+    auto search = sample_search<T>(estimator, 0);
+    parallel_for(n, options.threads, options.chunk_size,
+        [=, &points, &index](std::size_t begin, std::size_t end) mutable
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            for (int k = 0; k < dim; k++)
+                row[k] = points(i, k);
+            ibw[i] = sample_point(estimator, row.data(), index, dim, metric,
+                search, 0);
+        }
+    });
+
+    // Points with more duplicates than neighbors get the narrowest finite
+    // bandwidth. The weights are relative to the narrowest one.
+    const auto inf = std::numeric_limits<double>::infinity();
+    double max_ibw = 0, min_ibw = inf, min_width = inf;
+    for (std::size_t i = 0; i < n; i++)
+        if (ibw[i] < inf)
+            max_ibw = std::max(max_ibw, ibw[i]);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        if (!(ibw[i] < inf))
+            ibw[i] = max_ibw > 0 ? max_ibw : 1;
+        min_ibw = std::min(min_ibw, ibw[i]);
+        weight[i] = metric_bound(metric, 1 / ibw[i], 0);
+        if (weight[i] == inf)
+            weight[i] = 1 / ibw[i];
+        min_width = std::min(min_width, weight[i]);
+    }
+    for (std::size_t i = 0; i < n; i++)
+        weight[i] = std::pow(min_width / weight[i], dim + 2);
+
+    PointBandwidths bandwidths;
+    bandwidths.ibw = ibw;
+    bandwidths.weight = weight;
+    bandwidths.size = n;
+    bandwidths.min_ibw = min_ibw;
+    return bandwidths;
+}
+
+template <class T, class Estimator, class Index, class Dim, class Metric>
+inline Estimator sample_points(const Estimator& estimator, const Index&,
+    Dim, Metric, const Options&, std::vector<double>&, long)
+{
+    return estimator;
+}
+
+template <class Acc, class T, class ForwardIterator, class Dim, class Index,
+          class Metric, class Kernel, class Estimator, class Observer>
+inline void shift(Matrix<T>& shifted,
+    ForwardIterator first, ForwardIterator last, Dim dim,
     Metric metric, Kernel kernel, Estimator estimator,
-    double epsilon = std::numeric_limits<float>::epsilon(),
-    int max_iter = std::numeric_limits<int>::max())
+    const Index& index, const Options& options, Observer& observer)
+{
+    const bool absorb = options.absorb_tolerance > 0;
+    Basins basins(dim, absorb ? options.absorb_tolerance : 1);
+
+    std::vector<T> next(dim);
+    std::vector<long long> path, key(dim);
+    typename Observer::Counters counters;
+    observer.seeds(shifted.size());
+    Control* control = options.control;
+    if (control)
+        control->start(shifted.size());
+    // The buffers are captured by value, so that every thread has its own.
+    parallel_for(shifted.size(), options.threads, options.chunk_size,
+        [=, &shifted, &basins, &index, &observer](std::size_t begin,
+        std::size_t end) mutable
+    {
+        std::size_t finished = 0;
+        for (auto i = begin; i < end; i++)
+        {
+            if (control && control->stop())
+                break;
+            T* pt = shifted.row(i);
+            int iter = 0;
+            double d = 0;
+            auto owner = i;
+            path.clear();
+            do
+            {
+                if (absorb)
+                {
+                    basins.cell(pt, key.data());
+                    if (basins.find(key, owner))
+                    {
+                        const T* mode = shifted.row(owner);
+                        for (int k = 0; k < dim; k++)
+                            pt[k] = mode[k];
+                        break;
+                    }
+                    path.insert(path.end(), key.begin(), key.end());
+                }
+                shift_point<Acc>(pt, first, last, dim,
+                    metric, kernel, estimator, index, next.data(), counters);
+                d = metric(pt, next.data(), dim);
+                for (int k = 0; k < dim; k++)
+                    pt[k] = next[k];
+                iter++;
+            }
+            while (d > options.epsilon && iter < options.max_iter &&
+                !(control && control->stop()));
+            observer.seed(i, iter);
+            if (d > options.epsilon && iter == options.max_iter)
+                counters.capped();
+            if (control && control->interrupted())
+                break;
+            finished++;
+
+            if (absorb)
+            {
+                if (owner == i)
+                {
+                    basins.cell(pt, key.data());
+                    path.insert(path.end(), key.begin(), key.end());
+                }
+                basins.insert(path, key, owner);
+            }
+        }
+        observer.merge(counters);
+        counters = typename Observer::Counters();
+        if (control && finished > 0)
+            control->advance(finished);
+    });
+}
+
+// Greedy mode merging: each point joins the first cluster whose mode lies
+// within epsilon, or else founds a new one. Founders are settled in order,
+// serially, and each marks the undecided points around it; with a metric
+// bound the candidates come from a grid of epsilon-sized cells over the
+// leading (at most three) coordinates. Only candidate sets large enough to
+// pay for starting the threads are marked on `threads` threads. The control
+// is polled before every founder; once the run is interrupted, the points
+// not yet settled become clusters of their own.
+template <class T, class Dim, class Metric>
+inline std::vector<Cluster<T>> cluster(const T* data, std::size_t n,
+    std::size_t ld, Dim dim, Metric metric, double epsilon, int threads = 0,
+    Control* control = nullptr)
+{
+    const std::size_t parallel_candidates = 1 << 16;
+    const auto none = n;
+    const auto cell_size = metric_bound(metric, epsilon, 0);
+    const bool grid = cell_size > 0 &&
+        cell_size < std::numeric_limits<double>::infinity();
+    const int axes = grid ? std::min(static_cast<int>(dim), 3) : 0;
+
+    std::vector<std::size_t> founder(n, none);
+    std::unordered_map<std::vector<long long>, std::vector<std::size_t>,
+        CellHash> cells;
+    std::vector<long long> key(axes), offset(axes);
+    if (grid)
+    {
+        for (std::size_t i = 0; i < n; i++)
+        {
+            for (int k = 0; k < axes; k++)
+                key[k] = static_cast<long long>(
+                    std::floor(data[i * ld + k] / cell_size));
+            cells[key].emplace_back(i);
+        }
+    }
+    else
+    {
+        auto& all = cells[key];
+        all.resize(n);
+        for (std::size_t i = 0; i < n; i++)
+            all[i] = i;
+    }
+
+    std::vector<std::size_t> founders;
+    std::vector<std::vector<std::size_t>*> candidates;
+    for (std::size_t p = 0; p < n; p++)
+    {
+        if (founder[p] != none)
+            continue;
+        founder[p] = p;
+        founders.emplace_back(p);
+        if (control && control->stop())
+            continue;
+        const T* mode = data + p * ld;
+
+        candidates.clear();
+        if (grid)
+        {
+            std::fill(offset.begin(), offset.end(), -1);
+            for (;;)
+            {
+                for (int k = 0; k < axes; k++)
+                    key[k] = static_cast<long long>(
+                        std::floor(mode[k] / cell_size)) + offset[k];
+                const auto it = cells.find(key);
+                if (it != cells.end())
+                    candidates.emplace_back(&it->second);
+                int k = 0;
+                for (; k < axes && offset[k] == 1; k++)
+                    offset[k] = -1;
+                if (k == axes)
+                    break;
+                offset[k]++;
+            }
+        }
+        else
+            candidates.emplace_back(&cells.begin()->second);
+
+        for (auto members : candidates)
+        {
+            const auto m = members->size();
+            const auto mark = [&](std::size_t begin, std::size_t end)
+            {
+                for (auto j = begin; j < end; j++)
+                {
+                    const auto i = (*members)[j];
+                    if (founder[i] == none &&
+                        metric(data + i * ld, mode, dim) <= epsilon)
+                        founder[i] = p;
+                }
+            };
+            if (m < parallel_candidates)
+                mark(0, m);
+            else
+                parallel_for(m, threads, 0, mark);
+            members->erase(std::remove_if(members->begin(), members->end(),
+                [&](std::size_t i) { return founder[i] != none; }),
+                members->end());
+        }
+    }
+
+    std::vector<Cluster<T>> clusters;
+    clusters.reserve(founders.size());
+    for (auto p : founders)
+        clusters.emplace_back(data + p * ld, dim);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const auto c = std::lower_bound(founders.begin(), founders.end(),
+            founder[i]) - founders.begin();
+        clusters[c].members.emplace_back(i);
+    }
+    return clusters;
+}
+
+template <class T, class Dim, class Metric>
+inline std::vector<Cluster<T>> cluster(const Matrix<T>& shifted, Dim dim,
+    Metric metric, double epsilon, int threads = 0,
+    Control* control = nullptr)
+{
+    return cluster(shifted.data(), shifted.size(), shifted.ld(), dim,
+        metric, epsilon, threads, control);
+}
+
+template <class T, class Index, class Dim, class Metric>
+inline std::vector<Cluster<T>> assign_nearest(
+    const std::vector<Cluster<T>>& modes, const Index& index, Dim dim,
+    Metric metric)
+{
+    const auto& points = index.points();
+    std::vector<std::size_t> labels(points.size());
+    #pragma omp parallel for
+    for (std::size_t i = 0; i < points.size(); i++)
+    {
+        static thread_local std::vector<T> row;
+        row.resize(dim);
+        for (int k = 0; k < dim; k++)
+            row[k] = points(i, k);
+        auto dmin = std::numeric_limits<double>::infinity();
+        for (std::size_t c = 0; c < modes.size(); c++)
+        {
+            const auto d = metric(row.data(), modes[c].mode.data(), dim);
+            if (d < dmin)
+            {
+                dmin = d;
+                labels[index.id(i)] = c;
+            }
+        }
+    }
+
+    std::vector<Cluster<T>> clusters;
+    std::vector<std::size_t> remap(modes.size(), modes.size());
+    for (std::size_t i = 0; i < labels.size(); i++)
+    {
+        auto& c = remap[labels[i]];
+        if (c == modes.size())
+        {
+            c = clusters.size();
+            clusters.emplace_back(modes[labels[i]].mode.data(), dim);
+        }
+        clusters[c].members.emplace_back(i);
+    }
+    return clusters;
+}
+} // namespace detail
+
+template <class T, class ForwardIterator>
+inline Matrix<T> bin_seeds(
+    ForwardIterator first, ForwardIterator last, int dim,
+    double bin_size, std::size_t min_bin_freq = 1)
 {
     if (dim <= 0)
         throw std::invalid_argument("Dimension must be greater than 0");
+    if (!(bin_size > 0))
+        throw std::invalid_argument("Bin size must be greater than 0");
     typedef typename std::iterator_traits<ForwardIterator>::value_type C;
-    std::vector<std::vector<T>> shifted(std::distance(first, last));
-    std::size_t i = 0;
-    for (auto it = first; it != last; it++, i++)
+
+    std::unordered_map<std::vector<long long>, std::size_t,
+        detail::CellHash> bins;
+    std::vector<std::vector<double>> sums;
+    std::vector<std::size_t> counts;
+    std::vector<long long> key(dim);
+    for (auto it = first; it != last; it++)
     {
         const T* pt = Accessor<T, C>::data(*it);
-        shifted[i].resize(dim);
         for (int k = 0; k < dim; k++)
-            shifted[i][k] = pt[k];
+            key[k] = static_cast<long long>(std::floor(pt[k] / bin_size));
+        const auto b = bins.emplace(key, sums.size()).first->second;
+        if (b == sums.size())
+        {
+            sums.emplace_back(dim);
+            counts.emplace_back(0);
+        }
+        for (int k = 0; k < dim; k++)
+            sums[b][k] += pt[k];
+        counts[b]++;
     }
 
-    #pragma omp parallel for
-    for (std::size_t i = 0; i < shifted.size(); i++)
+    std::size_t n = 0;
+    for (const auto& count : counts)
+        if (count >= min_bin_freq)
+            n++;
+    if (n == 0 && !counts.empty())
+        throw std::invalid_argument(
+            "No bin has at least min_bin_freq points");
+    Matrix<T> seeds(n, dim);
+    for (std::size_t b = 0, i = 0; b < sums.size(); b++)
+    {
+        if (counts[b] < min_bin_freq)
+            continue;
+        for (int k = 0; k < dim; k++)
+            seeds(i, k) = static_cast<T>(sums[b][k] / counts[b]);
+        i++;
+    }
+    return seeds;
+}
+
+// Unique points of a data set, weighted by the number of input points each
+// stands for, along with the unique point of every input point. They can be
+// clustered through `begin()` and `end()`, with `weights` as the weights of
+// the options, and the clusters mapped back with `expand_clusters`.
+template <class T>
+struct Collapsed
+{
+    std::vector<T> points;
+    std::vector<double> weights;
+    std::vector<std::size_t> index;
+    int dim;
+
+    std::size_t size() const
+    {
+        return weights.size();
+    }
+
+    RowIterator<T> begin() const
     {
-        const T* pt = shifted[i].data();
-        int iter = 0;
-        double d = 0;
-        do
+        return RowIterator<T>(points.data(), dim);
+    }
+
+    RowIterator<T> end() const
+    {
+        return begin() + size();
+    }
+};
+
+// Collapses equal points or, with a positive `quantum`, the points that
+// fall in the same cell of a grid of that side, which are replaced by their
+// mean.
+template <class T, class InputIterator>
+inline Collapsed<T> collapse_duplicates(InputIterator first,
+    InputIterator last, int dim, double quantum = 0)
+{
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    typedef typename std::iterator_traits<InputIterator>::value_type C;
+
+    Collapsed<T> collapsed;
+    collapsed.dim = dim;
+    std::unordered_map<std::vector<long long>, std::size_t,
+        detail::CellHash> unique;
+    std::vector<long long> key(dim);
+    std::vector<double> sums;
+    for (auto it = first; it != last; it++)
+    {
+        const T* pt = Accessor<T, C>::data(*it);
+        for (int k = 0; k < dim; k++)
+        {
+            if (quantum > 0)
+                key[k] = static_cast<long long>(std::floor(pt[k] / quantum));
+            else
+            {
+                // The bits of the value, with -0 taken as 0.
+                const T v = pt[k] + T(0);
+                std::uint64_t bits = 0;
+                std::memcpy(&bits, &v, sizeof(T) < 8 ? sizeof(T) : 8);
+                key[k] = static_cast<long long>(bits);
+            }
+        }
+        const auto u = unique.emplace(key, collapsed.weights.size())
+            .first->second;
+        if (u == collapsed.weights.size())
         {
-            const auto point = mean_shift(
-                pt, first, last, dim, metric, kernel, estimator);
-            d = metric(pt, point.data(), dim);
-            shifted[i] = point;
-            iter++;
+            collapsed.points.insert(collapsed.points.end(), pt, pt + dim);
+            collapsed.weights.push_back(0);
+            sums.resize(sums.size() + dim, 0);
         }
-        while (d > epsilon && iter < max_iter);
+        for (int k = 0; k < dim; k++)
+            sums[u * dim + k] += pt[k];
+        collapsed.weights[u]++;
+        collapsed.index.push_back(u);
     }
+    if (quantum > 0)
+        for (std::size_t u = 0; u < collapsed.weights.size(); u++)
+            for (int k = 0; k < dim; k++)
+                collapsed.points[u * dim + k] = static_cast<T>(
+                    sums[u * dim + k] / collapsed.weights[u]);
+    return collapsed;
+}
 
-    return shifted;
+// Clusters of the input points of `collapse_duplicates`, from those of the
+// unique points. The members of every cluster are in input order.
+template <class T>
+inline std::vector<Cluster<T>> expand_clusters(
+    const std::vector<Cluster<T>>& clusters, const Collapsed<T>& collapsed)
+{
+    std::vector<std::size_t> labels(collapsed.size());
+    for (std::size_t c = 0; c < clusters.size(); c++)
+        for (const auto u : clusters[c].members)
+            labels[u] = c;
+    std::vector<Cluster<T>> result;
+    result.reserve(clusters.size());
+    for (const auto& cluster : clusters)
+        result.emplace_back(cluster.mode.data(),
+            static_cast<int>(cluster.mode.size()));
+    for (std::size_t i = 0; i < collapsed.index.size(); i++)
+        result[labels[collapsed.index[i]]].members.push_back(i);
+    return result;
+}
+
+template <class T, class Acc = double, class ForwardIterator,
+          class Metric, class Kernel, class Estimator,
+          class Neighbors = neighbors::Linear>
+inline std::vector<std::vector<T>> mean_shift(
+    ForwardIterator first, ForwardIterator last, int dim,
+    Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options, Neighbors neighbors = Neighbors())
+{
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    auto shifted = pack<T>(first, last, dim);
+    const auto layout = detail::resolve_layout<T>(options.layout, metric);
+    const auto index = neighbors.build(pack<T>(first, last, dim, layout));
+    std::vector<double> storage;
+    const auto bandwidths = detail::sample_points<T>(estimator, index, dim,
+        metric, options, storage, 0);
+    NoStats observer;
+    if (options.weights)
+    {
+        const auto weights = detail::index_weights(index, options.weights);
+        const detail::Weighted<typename std::decay<decltype(bandwidths)>::type>
+            weighted = {bandwidths, weights.data()};
+        detail::shift<Acc>(shifted, first, last, dim,
+            metric, kernel, weighted, index, options, observer);
+    }
+    else
+        detail::shift<Acc>(shifted, first, last, dim,
+            metric, kernel, bandwidths, index, options, observer);
+    std::vector<std::vector<T>> result(shifted.size());
+    for (std::size_t i = 0; i < shifted.size(); i++)
+        result[i].assign(shifted.row(i), shifted.row(i) + dim);
+    return result;
+}
+
+template <class T, class ForwardIterator,
+          class Metric, class Kernel, class Estimator>
+inline std::vector<std::vector<T>> mean_shift(
+    ForwardIterator first, ForwardIterator last, int dim,
+    Metric metric, Kernel kernel, Estimator estimator,
+    double epsilon = std::numeric_limits<float>::epsilon(),
+    int max_iter = std::numeric_limits<int>::max())
+{
+    Options options;
+    options.epsilon = epsilon;
+    options.max_iter = max_iter;
+    return mean_shift<T>(
+        first, last, dim, metric, kernel, estimator, options);
 }
 
 template <class T, class InputIterator, class Metric>
@@ -134,23 +1733,115 @@ inline std::vector<Cluster<T>> cluster_shifted(
     if (dim <= 0)
         throw std::invalid_argument("Dimension must be greater than 0");
     typedef typename std::iterator_traits<InputIterator>::value_type C;
-    std::vector<Cluster<T>> clusters;
-    std::size_t i = 0;
-    for (auto it = first; it != last; it++, i++)
+    std::vector<T> data;
+    for (auto it = first; it != last; it++)
     {
         const T* pt = Accessor<T, C>::data(*it);
-        std::size_t c = 0;
-        for (; c < clusters.size(); c++)
-            if (metric(pt, clusters[c].mode.data(), dim) <= epsilon)
-                break;
-        if (c == clusters.size())
-            clusters.emplace_back(pt, dim);
-        clusters[c].members.emplace_back(i);
+        data.insert(data.end(), pt, pt + dim);
+    }
+    return detail::cluster(data.data(), data.size() / dim,
+        static_cast<std::size_t>(dim), dim, metric, epsilon);
+}
+
+namespace detail
+{
+template <class T, class Acc, class ForwardIterator, class Dim,
+          class Metric, class Kernel, class Bandwidths, class Index,
+          class Observer>
+inline std::vector<Cluster<T>> shift_and_cluster(
+    ForwardIterator first, ForwardIterator last, Dim dim,
+    Metric metric, Kernel kernel, const Bandwidths& bandwidths,
+    const Index& index, const Options& options, Observer& observer)
+{
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+    if (!options.bin_seeding)
+    {
+        observer.start(Phase::Seeding);
+        auto shifted = pack<T>(first, last, dim);
+        observer.stop(Phase::Seeding);
+        observer.start(Phase::Shift);
+        shift<Acc>(shifted, first, last, dim,
+            metric, kernel, bandwidths, index, options, observer);
+        observer.stop(Phase::Shift);
+        observer.start(Phase::Merge);
+        auto clusters = cluster(shifted, dim, metric, options.epsilon,
+            options.threads, options.control);
+        observer.stop(Phase::Merge);
+        return clusters;
     }
 
+    auto bin_size = options.bin_size;
+    if (bin_size <= 0)
+        bin_size = metric_bound(metric, 1 / mean_ibw(bandwidth(bandwidths,
+            Accessor<T, C>::data(*first), first, last, dim, metric)), 0);
+    if (bin_size == std::numeric_limits<double>::infinity())
+        throw std::invalid_argument(
+            "Bin size must be given for metrics without bound");
+    observer.start(Phase::Seeding);
+    auto shifted = bin_seeds<T>(first, last, dim,
+        bin_size, options.min_bin_freq);
+    observer.stop(Phase::Seeding);
+    observer.start(Phase::Shift);
+    shift<Acc>(shifted, first, last, dim,
+        metric, kernel, bandwidths, index, options, observer);
+    observer.stop(Phase::Shift);
+    observer.start(Phase::Merge);
+    const auto modes = cluster(shifted, dim, metric, options.epsilon,
+        options.threads, options.control);
+    observer.stop(Phase::Merge);
+    observer.start(Phase::Assign);
+    auto clusters = assign_nearest(modes, index, dim, metric);
+    observer.stop(Phase::Assign);
     return clusters;
 }
 
+template <class T, class Acc, class ForwardIterator, class Dim,
+          class Metric, class Kernel, class Estimator, class Neighbors,
+          class Observer>
+inline std::vector<Cluster<T>> mean_shift_cluster(
+    ForwardIterator first, ForwardIterator last, Dim dim,
+    Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options, Neighbors neighbors, Observer& observer)
+{
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    if (first == last)
+        return std::vector<Cluster<T>>();
+    observer.start(Phase::Index);
+    const auto layout = resolve_layout<T>(options.layout, metric);
+    const auto index = neighbors.build(pack<T>(first, last, dim, layout));
+    observer.stop(Phase::Index);
+    observer.start(Phase::Estimator);
+    std::vector<double> storage;
+    const auto bandwidths = sample_points<T>(estimator, index, dim,
+        metric, options, storage, 0);
+    observer.stop(Phase::Estimator);
+    if (!options.weights)
+        return shift_and_cluster<T, Acc>(first, last, dim, metric, kernel,
+            bandwidths, index, options, observer);
+    const auto weights = index_weights(index, options.weights);
+    const Weighted<typename std::decay<decltype(bandwidths)>::type>
+        weighted = {bandwidths, weights.data()};
+    return shift_and_cluster<T, Acc>(first, last, dim, metric, kernel,
+        weighted, index, options, observer);
+}
+} // namespace detail
+
+// The observer (see `Stats`) is passed by reference; the default one
+// collects nothing.
+template <class T, class Acc = double, class ForwardIterator,
+          class Metric, class Kernel, class Estimator,
+          class Neighbors = neighbors::Linear, class Observer = NoStats>
+inline std::vector<Cluster<T>> mean_shift_cluster(
+    ForwardIterator first, ForwardIterator last, int dim,
+    Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options, Neighbors neighbors = Neighbors(),
+    Observer&& observer = Observer())
+{
+    return detail::mean_shift_cluster<T, Acc>(first, last, dim,
+        metric, kernel, estimator, options, neighbors, observer);
+}
+
 template <class T, class ForwardIterator,
           class Metric, class Kernel, class Estimator>
 inline std::vector<Cluster<T>> mean_shift_cluster(
@@ -159,9 +1850,74 @@ inline std::vector<Cluster<T>> mean_shift_cluster(
     double epsilon = std::numeric_limits<float>::epsilon(),
     int max_iter = std::numeric_limits<int>::max())
 {
-    const auto shifted = mean_shift<T>(
-        first, last, dim, metric, kernel, estimator, epsilon, max_iter);
-    return cluster_shifted<T>(
-        std::begin(shifted), std::end(shifted), dim, metric, epsilon);
+    Options options;
+    options.epsilon = epsilon;
+    options.max_iter = max_iter;
+    return mean_shift_cluster<T>(
+        first, last, dim, metric, kernel, estimator, options);
+}
+
+// Variants with the dimension fixed at compile time, so that the metric,
+// the accumulation and the convergence checks get fully unrolled.
+template <class T, int N, class Acc = double, class ForwardIterator,
+          class Metric, class Kernel, class Estimator,
+          class Neighbors = neighbors::Linear, class Observer = NoStats>
+inline std::vector<Cluster<T>> mean_shift_cluster(
+    ForwardIterator first, ForwardIterator last,
+    Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options, Neighbors neighbors = Neighbors(),
+    Observer&& observer = Observer())
+{
+    return detail::mean_shift_cluster<T, Acc>(first, last,
+        std::integral_constant<int, N>(),
+        metric, kernel, estimator, options, neighbors, observer);
+}
+
+template <class T, int N, class ForwardIterator,
+          class Metric, class Kernel, class Estimator>
+inline std::vector<Cluster<T>> mean_shift_cluster(
+    ForwardIterator first, ForwardIterator last,
+    Metric metric, Kernel kernel, Estimator estimator,
+    double epsilon = std::numeric_limits<float>::epsilon(),
+    int max_iter = std::numeric_limits<int>::max())
+{
+    Options options;
+    options.epsilon = epsilon;
+    options.max_iter = max_iter;
+    return mean_shift_cluster<T, N>(
+        first, last, metric, kernel, estimator, options);
+}
+
+// Variants taking the dimension from the `dim` constant of the Accessor of
+// the container, when it has one.
+template <class T, class Acc = double, class ForwardIterator,
+          class Metric, class Kernel, class Estimator,
+          class Neighbors = neighbors::Linear, class Observer = NoStats>
+inline typename std::enable_if<(static_dim<T, typename
+    std::iterator_traits<ForwardIterator>::value_type>::value > 0),
+    std::vector<Cluster<T>>>::type mean_shift_cluster(
+    ForwardIterator first, ForwardIterator last,
+    Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options, Neighbors neighbors = Neighbors(),
+    Observer&& observer = Observer())
+{
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+    return mean_shift_cluster<T, static_dim<T, C>::value, Acc>(first, last,
+        metric, kernel, estimator, options, neighbors, observer);
+}
+
+template <class T, class ForwardIterator,
+          class Metric, class Kernel, class Estimator>
+inline typename std::enable_if<(static_dim<T, typename
+    std::iterator_traits<ForwardIterator>::value_type>::value > 0),
+    std::vector<Cluster<T>>>::type mean_shift_cluster(
+    ForwardIterator first, ForwardIterator last,
+    Metric metric, Kernel kernel, Estimator estimator,
+    double epsilon = std::numeric_limits<float>::epsilon(),
+    int max_iter = std::numeric_limits<int>::max())
+{
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+    return mean_shift_cluster<T, static_dim<T, C>::value>(first, last,
+        metric, kernel, estimator, epsilon, max_iter);
 }
 } // namespace msc
@@ -0,0 +1,368 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "msc.h"
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+namespace msc
+{
+// Result of mean shift on an image of `width` by `height` pixels with
+// `channels` values each, stored row by row. `filtered` holds, for every
+// pixel, the range values of the mode it converged to, and `labels` the
+// segment of every pixel, whose mean filtered values are in `segments`.
+template <class T>
+struct ImageSegmentation
+{
+    std::vector<T> filtered;
+    std::vector<std::size_t> labels;
+    std::vector<T> segments;
+    int width;
+    int height;
+    int channels;
+
+    std::size_t segment_count() const
+    {
+        return segments.size() / channels;
+    }
+};
+
+namespace detail
+{
+const int image_tile = 64;
+
+template <class T>
+inline T round_value(double v, std::true_type)
+{
+    const auto lo = static_cast<double>(std::numeric_limits<T>::lowest());
+    const auto hi = static_cast<double>(std::numeric_limits<T>::max());
+    return static_cast<T>(std::min(hi, std::max(lo, std::round(v))));
+}
+
+template <class T>
+inline T round_value(double v, std::false_type)
+{
+    return static_cast<T>(v);
+}
+
+inline std::size_t find_root(std::vector<std::size_t>& parent, std::size_t i)
+{
+    while (parent[i] != i)
+        i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+inline void join(std::vector<std::size_t>& parent, std::size_t a,
+    std::size_t b)
+{
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a != b)
+        parent[std::max(a, b)] = std::min(a, b);
+}
+
+// The pixel values in the type of the sums, converted once rather than at
+// every kernel evaluation.
+template <class Acc>
+inline const Acc* pixel_values(const Acc* pixels, std::size_t,
+    std::vector<Acc>&)
+{
+    return pixels;
+}
+
+template <class Acc, class T>
+inline const Acc* pixel_values(const T* pixels, std::size_t n,
+    std::vector<Acc>& values)
+{
+    values.assign(pixels, pixels + n);
+    return values.data();
+}
+
+// Sums over the channels of a pixel, kept in registers when the number of
+// channels is known at compile time and in a per-thread buffer otherwise.
+template <class Acc, class Channels>
+struct ChannelSums
+{
+    Acc* values;
+
+    explicit ChannelSums(Acc* buffer)
+        : values(buffer) {}
+
+    Acc& operator[](int c)
+    {
+        return values[c];
+    }
+};
+
+template <class Acc, int N>
+struct ChannelSums<Acc, std::integral_constant<int, N>>
+{
+    Acc values[N];
+
+    explicit ChannelSums(Acc*) {}
+
+    Acc& operator[](int c)
+    {
+        return values[c];
+    }
+};
+
+// Shifts the pixel at (x, y) in the joint spatial-range domain, where the
+// kernel sees the squared distance with the spatial offsets scaled by `is`
+// and the range ones by `ir`. Only the pixels within the support of the
+// kernel, row by row, are visited. Leaves the range values of the mode in
+// `range` and returns the iterations taken.
+template <class Acc, class Channels, class Kernel>
+inline int shift_pixel(const Acc* values, int width, int height,
+    Channels channels, int x, int y, Kernel kernel, double support,
+    double is, double ir, const Options& options, Acc* range, Acc* buffer)
+{
+    ChannelSums<Acc, Channels> mode(range), sums(buffer);
+    const Acc* px = values + (static_cast<std::size_t>(y) * width + x) *
+        channels;
+    for (int c = 0; c < channels; c++)
+        mode[c] = px[c];
+    Acc sx = x, sy = y;
+    const auto reach = std::sqrt(support / is);
+    int iter = 0;
+    while (iter < options.max_iter)
+    {
+        iter++;
+        for (int c = 0; c < channels; c++)
+            sums[c] = 0;
+        Acc total_weight = 0, wy = 0, wx = 0;
+        const int y0 = std::max(0, static_cast<int>(std::ceil(sy - reach)));
+        const int y1 = std::min(height - 1,
+            static_cast<int>(std::floor(sy + reach)));
+        for (int qy = y0; qy <= y1; qy++)
+        {
+            const Acc dy2 = (qy - sy) * (qy - sy) * is;
+            const auto dx = std::sqrt(std::max(0.0,
+                static_cast<double>(support - dy2) / is));
+            const int x0 = std::max(0, static_cast<int>(std::ceil(sx - dx)));
+            const int x1 = std::min(width - 1,
+                static_cast<int>(std::floor(sx + dx)));
+            const Acc* q = values + (static_cast<std::size_t>(qy) * width +
+                x0) * channels;
+            Acc fx = x0, row_weight = 0;
+            for (int qx = x0; qx <= x1; qx++, q += channels, fx++)
+            {
+                // No early exit: the kernel is zero past its support, and
+                // branches on the range values mispredict in textured areas.
+                Acc d2 = 0;
+                for (int c = 0; c < channels; c++)
+                    d2 += (q[c] - mode[c]) * (q[c] - mode[c]);
+                const Acc w = kernel(dy2 + (fx - sx) * (fx - sx) * is +
+                    d2 * ir);
+                wx += w * fx;
+                for (int c = 0; c < channels; c++)
+                    sums[c] += w * q[c];
+                row_weight += w;
+            }
+            wy += row_weight * qy;
+            total_weight += row_weight;
+        }
+        if (total_weight == 0)
+            break;
+
+        const Acc nx = wx / total_weight, ny = wy / total_weight;
+        Acc moved = ((nx - sx) * (nx - sx) + (ny - sy) * (ny - sy)) * is;
+        for (int c = 0; c < channels; c++)
+        {
+            const Acc v = sums[c] / total_weight;
+            moved += (v - mode[c]) * (v - mode[c]) * ir;
+            mode[c] = v;
+        }
+        sx = nx;
+        sy = ny;
+        if (moved <= options.epsilon)
+            break;
+    }
+    for (int c = 0; c < channels; c++)
+        range[c] = mode[c];
+    return iter;
+}
+
+// Filters the image tile by tile, in parallel, writing the range values of
+// the mode of every pixel to `filtered`.
+template <class Acc, class T, class Channels, class Kernel>
+inline void filter_image(const Acc* values, int width, int height,
+    Channels channels, Kernel kernel, double support, double is, double ir,
+    const Options& options, T* filtered)
+{
+    const auto n = static_cast<std::size_t>(width) * height;
+    const int tiles_x = (width + image_tile - 1) / image_tile;
+    const int tiles_y = (height + image_tile - 1) / image_tile;
+    Control* control = options.control;
+    if (control)
+        control->start(n);
+    std::vector<Acc> range(channels), sums(channels);
+    parallel_for(static_cast<std::size_t>(tiles_x) * tiles_y,
+        options.threads, options.chunk_size,
+        [&, range, sums](std::size_t begin, std::size_t end) mutable
+    {
+        for (auto t = begin; t < end; t++)
+        {
+            if (control && control->stop())
+                break;
+            const int x0 = static_cast<int>(t % tiles_x) * image_tile;
+            const int y0 = static_cast<int>(t / tiles_x) * image_tile;
+            const int x1 = std::min(width, x0 + image_tile);
+            const int y1 = std::min(height, y0 + image_tile);
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                {
+                    shift_pixel(values, width, height, channels, x, y,
+                        kernel, support, is, ir, options, range.data(),
+                        sums.data());
+                    T* out = filtered + (static_cast<std::size_t>(y) *
+                        width + x) * channels;
+                    for (int c = 0; c < channels; c++)
+                        out[c] = round_value<T>(range[c],
+                            std::is_integral<T>());
+                }
+            }
+            if (control)
+                control->advance(static_cast<std::size_t>(x1 - x0) *
+                    (y1 - y0));
+        }
+    });
+}
+} // namespace detail
+
+// Mean shift filtering and segmentation of an image in the joint
+// spatial-range domain (Comaniciu and Meer). Every pixel is shifted over
+// the pixels within its spatial window, with the kernel evaluated on the
+// squared distance from the pixel position and values, scaled by
+// `spatial_bandwidth` and `range_bandwidth` respectively, so the kernel is
+// one of the squared distance (as `kernels::Uniform` or
+// `kernels::ParabolicSq`) and must have a finite support. The image is
+// processed in tiles, in parallel, and the shifts stop once they move less
+// than `options.epsilon` in those scaled units, or after `options.max_iter`
+// iterations. Adjacent pixels (in 4-connectivity) whose modes are within
+// half the range bandwidth form a segment. An interrupted run leaves the
+// pixels of the unfinished tiles unfiltered.
+template <class T, class Acc = double, class Kernel>
+inline ImageSegmentation<T> mean_shift_image(const T* pixels, int width,
+    int height, int channels, Kernel kernel, double spatial_bandwidth,
+    double range_bandwidth, const Options& options = Options())
+{
+    if (width <= 0 || height <= 0 || channels <= 0)
+        throw std::invalid_argument("Image dimensions must be greater than 0");
+    if (spatial_bandwidth <= 0 || range_bandwidth <= 0)
+        throw std::invalid_argument("Bandwidths must be greater than 0");
+    const auto support = detail::kernel_support(kernel, 0);
+    if (support == std::numeric_limits<double>::infinity())
+        throw std::invalid_argument(
+            "Image mean shift requires a kernel of finite support");
+
+    const auto n = static_cast<std::size_t>(width) * height;
+    ImageSegmentation<T> result;
+    result.width = width;
+    result.height = height;
+    result.channels = channels;
+    result.filtered.assign(pixels, pixels + n * channels);
+
+    const auto is = 1 / (spatial_bandwidth * spatial_bandwidth);
+    const auto ir = 1 / (range_bandwidth * range_bandwidth);
+    std::vector<Acc> storage;
+    const Acc* values = detail::pixel_values(pixels, n * channels, storage);
+    T* out = result.filtered.data();
+    switch (channels)
+    {
+    case 1:
+        detail::filter_image(values, width, height,
+            std::integral_constant<int, 1>(), kernel, support, is, ir,
+            options, out);
+        break;
+    case 3:
+        detail::filter_image(values, width, height,
+            std::integral_constant<int, 3>(), kernel, support, is, ir,
+            options, out);
+        break;
+    case 4:
+        detail::filter_image(values, width, height,
+            std::integral_constant<int, 4>(), kernel, support, is, ir,
+            options, out);
+        break;
+    default:
+        detail::filter_image(values, width, height, channels, kernel,
+            support, is, ir, options, out);
+    }
+
+    const T* filtered = result.filtered.data();
+    const auto near = [&](std::size_t a, std::size_t b)
+    {
+        double d2 = 0;
+        for (int c = 0; c < channels; c++)
+        {
+            const double d = static_cast<double>(filtered[a * channels + c]) -
+                filtered[b * channels + c];
+            d2 += d * d;
+        }
+        return d2 * ir <= 0.25;
+    };
+    std::vector<std::size_t> parent(n);
+    std::iota(parent.begin(), parent.end(), std::size_t(0));
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const auto x = i % width;
+        if (x + 1 < static_cast<std::size_t>(width) && near(i, i + 1))
+            detail::join(parent, i, i + 1);
+        if (i + width < n && near(i, i + width))
+            detail::join(parent, i, i + width);
+    }
+
+    const auto none = n;
+    std::vector<std::size_t> segment(n, none);
+    std::vector<double> totals, counts;
+    result.labels.resize(n);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        const auto root = detail::find_root(parent, i);
+        if (segment[root] == none)
+        {
+            segment[root] = counts.size();
+            counts.push_back(0);
+            totals.resize(totals.size() + channels, 0);
+        }
+        const auto s = segment[root];
+        result.labels[i] = s;
+        counts[s]++;
+        for (int c = 0; c < channels; c++)
+            totals[s * channels + c] += filtered[i * channels + c];
+    }
+    result.segments.resize(totals.size());
+    for (std::size_t s = 0; s < counts.size(); s++)
+        for (int c = 0; c < channels; c++)
+            result.segments[s * channels + c] = detail::round_value<T>(
+                totals[s * channels + c] / counts[s], std::is_integral<T>());
+    return result;
+}
+} // namespace msc
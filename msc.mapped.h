@@ -0,0 +1,446 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "msc.h"
+#include "msc.accessors.h"
+#include "msc.neighbors.h"
+#include "msc.estimators.h"
+
+#include <vector>
+#include <string>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace msc
+{
+// Layout of a point file: this header, followed by the points row by row.
+struct PointFileHeader
+{
+    char magic[4];
+    std::uint32_t scalar;
+    std::uint64_t size;
+    std::uint64_t dim;
+};
+
+template <class T>
+struct scalar_code;
+
+template <>
+struct scalar_code<float> : std::integral_constant<std::uint32_t, 1> {};
+
+template <>
+struct scalar_code<double> : std::integral_constant<std::uint32_t, 2> {};
+
+template <class T, class ForwardIterator>
+inline void write_points(const std::string& path,
+    ForwardIterator first, ForwardIterator last, int dim)
+{
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Cannot open " + path);
+    PointFileHeader header = {{'M', 'S', 'C', 'P'}, scalar_code<T>::value,
+        static_cast<std::uint64_t>(std::distance(first, last)),
+        static_cast<std::uint64_t>(dim)};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (auto it = first; it != last; it++)
+        out.write(reinterpret_cast<const char*>(Accessor<T, C>::data(*it)),
+            dim * sizeof(T));
+    if (!out)
+        throw std::runtime_error("Cannot write " + path);
+}
+
+// Read-only memory mapping of a point file, seen as a range of rows, so that
+// the pages are only loaded as they are visited.
+template <class T>
+class MappedPoints
+{
+public:
+    typedef RowIterator<T> iterator;
+
+    inline explicit MappedPoints(const std::string& path)
+        : data_(nullptr), bytes_(0), size_(0), dim_(0)
+    {
+        map(path);
+        PointFileHeader header;
+        if (bytes_ < sizeof(header))
+            fail("Truncated point file " + path);
+        std::memcpy(&header, data_, sizeof(header));
+        if (std::memcmp(header.magic, "MSCP", 4) != 0)
+            fail("Not a point file: " + path);
+        if (header.scalar != scalar_code<T>::value)
+            fail("Wrong scalar type in " + path);
+        if (header.dim == 0 || (bytes_ - sizeof(header)) / sizeof(T) /
+            header.dim < header.size)
+            fail("Truncated point file " + path);
+        size_ = static_cast<std::size_t>(header.size);
+        dim_ = static_cast<int>(header.dim);
+    }
+
+    inline ~MappedPoints()
+    {
+        unmap();
+    }
+
+    MappedPoints(const MappedPoints&) = delete;
+    MappedPoints& operator=(const MappedPoints&) = delete;
+
+    inline std::size_t size() const { return size_; }
+    inline int dim() const { return dim_; }
+
+    inline const T* row(std::size_t i) const
+    {
+        return reinterpret_cast<const T*>(data_ + sizeof(PointFileHeader)) +
+            i * dim_;
+    }
+
+    inline iterator begin() const { return iterator(row(0), dim_); }
+    inline iterator end() const { return iterator(row(size_), dim_); }
+
+private:
+    inline void fail(const std::string& message)
+    {
+        unmap();
+        throw std::runtime_error(message);
+    }
+
+#ifdef _WIN32
+    inline void map(const std::string& path)
+    {
+        file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+            nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Cannot open " + path);
+        LARGE_INTEGER size;
+        GetFileSizeEx(file_, &size);
+        bytes_ = static_cast<std::size_t>(size.QuadPart);
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY,
+            0, 0, nullptr);
+        if (mapping_)
+            data_ = static_cast<const char*>(
+                MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (!data_)
+            fail("Cannot map " + path);
+    }
+
+    inline void unmap()
+    {
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        data_ = nullptr;
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+    }
+
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    inline void map(const std::string& path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Cannot open " + path);
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            bytes_ = static_cast<std::size_t>(st.st_size);
+            void* data = mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, fd, 0);
+            if (data != MAP_FAILED)
+            {
+                data_ = static_cast<const char*>(data);
+                madvise(data, bytes_, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
+        if (!data_)
+            throw std::runtime_error("Cannot map " + path);
+    }
+
+    inline void unmap()
+    {
+        if (data_)
+            munmap(const_cast<char*>(data_), bytes_);
+        data_ = nullptr;
+    }
+#endif
+
+    const char* data_;
+    std::size_t bytes_;
+    std::size_t size_;
+    int dim_;
+};
+
+namespace detail
+{
+// Index of the mode nearest to a point, searched in a k-d tree of the modes
+// within boxes that double from `radius` until the nearest one is known.
+template <class T, class Index, class Metric>
+inline std::size_t nearest(const T* point, const Index& modes, int dim,
+    Metric metric, double radius)
+{
+    const auto& rows = modes.points();
+    for (;;)
+    {
+        auto dmin = std::numeric_limits<double>::infinity();
+        std::size_t best = 0;
+        modes.query(point, radius, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto j = begin; j < end; j++)
+            {
+                const auto d = metric(rows.row(j), point, dim);
+                if (d < dmin)
+                {
+                    dmin = d;
+                    best = modes.id(j);
+                }
+            }
+        });
+        if (radius == std::numeric_limits<double>::infinity() ||
+            (dmin < std::numeric_limits<double>::infinity() &&
+            metric_bound(metric, dmin, 0) <= radius))
+            return best;
+        radius = radius > 0 ? 2 * radius :
+            std::numeric_limits<double>::infinity();
+    }
+}
+
+// Labels the points, `block_size` at a time, with their nearest mode and
+// hands the labels of every block to `sink(first, labels, n)`.
+template <class T, class ForwardIterator, class Index, class Metric,
+          class Sink>
+inline void label_blocks(ForwardIterator first, ForwardIterator last,
+    int dim, Metric metric, const Index& modes, double radius,
+    std::size_t block_size, const Options& options, Sink sink)
+{
+    std::vector<std::uint32_t> labels;
+    std::size_t offset = 0;
+    for (auto it = first; it != last; )
+    {
+        auto stop = it;
+        for (std::size_t n = 0; n < block_size && stop != last; n++)
+            stop++;
+        const auto block = pack<T>(it, stop, dim);
+        labels.resize(block.size());
+        parallel_for(block.size(), options.threads,
+            options.chunk_size, [&](std::size_t begin, std::size_t end)
+        {
+            for (auto i = begin; i < end; i++)
+                labels[i] = static_cast<std::uint32_t>(nearest(
+                    block.row(i), modes, dim, metric, radius));
+        });
+        sink(offset, static_cast<const std::uint32_t*>(labels.data()),
+            labels.size());
+        offset += labels.size();
+        it = stop;
+    }
+}
+} // namespace detail
+
+// Out-of-core mean shift. The seeds come from bin seeding, and every
+// iteration shifts all of them in a single pass over the points, which are
+// packed and indexed `options.block_size` at a time, so that only one block
+// is in memory at once besides the indices of the leading blocks, which are
+// kept across iterations up to `options.cached_points` points. A pass over the points drops the modes that are not
+// the nearest of any, and a last one labels every point with its nearest mode
+// and hands the labels to `sink(first, labels, n)` block by block, in input
+// order. Returns the modes, each the label of at least one point. The
+// estimator must be flagged by `estimators::is_constant` (as `Constant` is):
+// it is evaluated once, and any other would need passes of its own over the
+// points for every seed.
+template <class T, class Acc = double, class ForwardIterator,
+          class Metric, class Kernel, class Estimator, class Sink,
+          class Neighbors = neighbors::Linear>
+inline std::vector<std::vector<T>> mean_shift_cluster_blocked(
+    ForwardIterator first, ForwardIterator last, int dim,
+    Metric metric, Kernel kernel, Estimator estimator,
+    const Options& options, Sink sink, Neighbors neighbors = Neighbors())
+{
+    typedef typename std::iterator_traits<ForwardIterator>::value_type C;
+    typedef decltype(neighbors.build(std::declval<Matrix<T>>())) Index;
+    if (dim <= 0)
+        throw std::invalid_argument("Dimension must be greater than 0");
+    if (first == last)
+        return std::vector<std::vector<T>>();
+    static_assert(estimators::is_constant<Estimator>::value,
+        "Out-of-core mean shift requires a constant estimator");
+    const auto block_size = std::max<std::size_t>(options.block_size, 1);
+
+    const double ibw = estimator(Accessor<T, C>::data(*first), first, last,
+        dim, metric);
+    auto bin_size = options.bin_size;
+    if (bin_size <= 0)
+        bin_size = detail::metric_bound(metric, 1 / ibw, 0);
+    if (bin_size == std::numeric_limits<double>::infinity())
+        throw std::invalid_argument(
+            "Bin size must be given for metrics without bound");
+    auto seeds = bin_seeds<T>(first, last, dim,
+        bin_size, options.min_bin_freq);
+
+    const auto layout = detail::resolve_layout<T>(options.layout, metric);
+    const auto m = seeds.size();
+    std::vector<std::size_t> active(m);
+    for (std::size_t s = 0; s < m; s++)
+        active[s] = s;
+    const auto radius = search_radius(metric, kernel, ibw);
+    std::vector<Acc> sums(m * dim), totals(m);
+    std::vector<T> next(dim);
+    const auto shift_block = [&](const Index& index)
+    {
+        const auto& points = index.points();
+        detail::parallel_for(active.size(), options.threads,
+            options.chunk_size, [&](std::size_t begin, std::size_t end)
+        {
+            NoStats::Counters counters;
+            for (auto a = begin; a < end; a++)
+            {
+                const auto s = active[a];
+                const T* seed = seeds.row(s);
+                index.query(seed, radius, [&](std::size_t b, std::size_t e)
+                {
+                    detail::accumulate(seed, points, b, e, dim, metric,
+                        kernel, ibw, &sums[s * dim], totals[s],
+                        counters, std::integral_constant<bool,
+                        has_batch<Metric, T>::value>());
+                });
+            }
+        });
+    };
+    // The indices of the leading blocks are kept for the later iterations,
+    // up to `options.cached_points` points.
+    std::vector<Index> cache;
+    std::size_t cached = 0;
+    Control* control = options.control;
+    if (control)
+        control->start(m);
+    for (int iter = 0; !active.empty() && iter < options.max_iter; iter++)
+    {
+        if (control && control->stop())
+            break;
+        for (auto s : active)
+        {
+            std::fill(&sums[s * dim], &sums[s * dim] + dim, Acc());
+            totals[s] = 0;
+        }
+
+        std::size_t block = 0;
+        for (auto it = first; it != last; block++)
+        {
+            if (control && control->stop())
+                break;
+            auto stop = it;
+            for (std::size_t n = 0; n < block_size && stop != last; n++)
+                stop++;
+            if (block < cache.size())
+                shift_block(cache[block]);
+            else
+            {
+                auto index = neighbors.build(pack<T>(it, stop, dim, layout));
+                shift_block(index);
+                if (block == cache.size() && cached +
+                    index.points().size() <= options.cached_points)
+                {
+                    cached += index.points().size();
+                    cache.emplace_back(std::move(index));
+                }
+            }
+            it = stop;
+        }
+        // An interrupted pass leaves the seeds where they were.
+        if (control && control->interrupted())
+            break;
+
+        std::size_t kept = 0;
+        for (auto s : active)
+        {
+            T* seed = seeds.row(s);
+            const auto total = static_cast<double>(totals[s]);
+            if (!(total > 0))
+                continue;
+            for (int k = 0; k < dim; k++)
+                next[k] = static_cast<T>(
+                    static_cast<double>(sums[s * dim + k]) / total);
+            const auto d = metric(seed, next.data(), dim);
+            for (int k = 0; k < dim; k++)
+                seed[k] = next[k];
+            if (d > options.epsilon)
+                active[kept++] = s;
+        }
+        if (control && kept < active.size())
+            control->advance(active.size() - kept);
+        active.resize(kept);
+    }
+
+    const auto clusters = detail::cluster(seeds, dim, metric,
+        options.epsilon, options.threads);
+    std::vector<std::vector<T>> modes;
+    for (const auto& cluster : clusters)
+        modes.emplace_back(cluster.mode);
+    auto tree = neighbors::KDTree().build(
+        pack<T>(modes.begin(), modes.end(), dim));
+
+    // The nearest used mode of every point is still its nearest mode once
+    // the others are gone.
+    std::vector<std::size_t> counts(modes.size());
+    detail::label_blocks<T>(first, last, dim, metric, tree, bin_size,
+        block_size, options,
+        [&](std::size_t, const std::uint32_t* labels, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            counts[labels[i]]++;
+    });
+    std::size_t used = 0;
+    for (std::size_t c = 0; c < modes.size(); c++)
+        if (counts[c] > 0)
+            modes[used++].swap(modes[c]);
+    if (used < modes.size())
+    {
+        modes.resize(used);
+        tree = neighbors::KDTree().build(
+            pack<T>(modes.begin(), modes.end(), dim));
+    }
+
+    detail::label_blocks<T>(first, last, dim, metric, tree, bin_size,
+        block_size, options, sink);
+    return modes;
+}
+} // namespace msc
@@ -22,11 +22,126 @@
 
 #include <vector>
 #include <cmath>
+#include <cstddef>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
 
 namespace msc
 {
 namespace metrics
 {
+namespace detail
+{
+// Squared L2 distances from the `n` points of a column-major block, where
+// coordinate `k` of point `j` is `b[k * ld + j]`, to `a`. The `batch`
+// members of the metrics below follow the same convention.
+template <class T>
+inline void l2sq_batch(const T* a, const T* b, std::size_t ld,
+    std::size_t n, int dim, double* out)
+{
+    for (std::size_t j = 0; j < n; j++)
+        out[j] = 0;
+    for (int k = 0; k < dim; k++)
+    {
+        const T* col = b + k * ld;
+        for (std::size_t j = 0; j < n; j++)
+            out[j] += (col[j] - a[k]) * (col[j] - a[k]);
+    }
+}
+
+#if defined(__AVX512F__)
+// The tail is handled with masks. Only zero-masking intrinsics are used: the
+// unmasked conversions, extractions and 256-bit casts merge into undefined
+// registers, which GCC reports as -Wmaybe-uninitialized.
+inline void l2sq_batch(const double* a, const double* b, std::size_t ld,
+    std::size_t n, int dim, double* out)
+{
+    for (std::size_t j = 0; j < n; j += 8)
+    {
+        const __mmask8 mask = n - j >= 8 ? 0xff : (1u << (n - j)) - 1;
+        auto acc = _mm512_setzero_pd();
+        for (int k = 0; k < dim; k++)
+        {
+            const auto v = _mm512_sub_pd(
+                _mm512_maskz_loadu_pd(mask, b + k * ld + j),
+                _mm512_set1_pd(a[k]));
+            acc = _mm512_fmadd_pd(v, v, acc);
+        }
+        _mm512_mask_storeu_pd(out + j, mask, acc);
+    }
+}
+
+inline void l2sq_batch(const float* a, const float* b, std::size_t ld,
+    std::size_t n, int dim, double* out)
+{
+    for (std::size_t j = 0; j < n; j += 16)
+    {
+        const __mmask16 mask = n - j >= 16 ? 0xffff : (1u << (n - j)) - 1;
+        auto lo = _mm512_setzero_pd(), hi = _mm512_setzero_pd();
+        for (int k = 0; k < dim; k++)
+        {
+            auto v = _mm512_sub_ps(
+                _mm512_maskz_loadu_ps(mask, b + k * ld + j),
+                _mm512_set1_ps(a[k]));
+            v = _mm512_mul_ps(v, v);
+            lo = _mm512_add_pd(lo, _mm512_maskz_cvtps_pd(0xff,
+                _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf,
+                _mm512_castps_pd(v), 0))));
+            hi = _mm512_add_pd(hi, _mm512_maskz_cvtps_pd(0xff,
+                _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xf,
+                _mm512_castps_pd(v), 1))));
+        }
+        _mm512_mask_storeu_pd(out + j, static_cast<__mmask8>(mask), lo);
+        _mm512_mask_storeu_pd(out + j + 8,
+            static_cast<__mmask8>(mask >> 8), hi);
+    }
+}
+#elif defined(__AVX2__) && defined(__FMA__)
+inline void l2sq_batch(const double* a, const double* b, std::size_t ld,
+    std::size_t n, int dim, double* out)
+{
+    std::size_t j = 0;
+    for (; j + 4 <= n; j += 4)
+    {
+        auto acc = _mm256_setzero_pd();
+        for (int k = 0; k < dim; k++)
+        {
+            const auto v = _mm256_sub_pd(
+                _mm256_loadu_pd(b + k * ld + j), _mm256_set1_pd(a[k]));
+            acc = _mm256_fmadd_pd(v, v, acc);
+        }
+        _mm256_storeu_pd(out + j, acc);
+    }
+    if (j < n)
+        l2sq_batch<double>(a, b + j, ld, n - j, dim, out + j);
+}
+
+inline void l2sq_batch(const float* a, const float* b, std::size_t ld,
+    std::size_t n, int dim, double* out)
+{
+    std::size_t j = 0;
+    for (; j + 8 <= n; j += 8)
+    {
+        auto lo = _mm256_setzero_pd(), hi = _mm256_setzero_pd();
+        for (int k = 0; k < dim; k++)
+        {
+            auto v = _mm256_sub_ps(
+                _mm256_loadu_ps(b + k * ld + j), _mm256_set1_ps(a[k]));
+            v = _mm256_mul_ps(v, v);
+            lo = _mm256_add_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(v)));
+            hi = _mm256_add_pd(hi, _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1)));
+        }
+        _mm256_storeu_pd(out + j, lo);
+        _mm256_storeu_pd(out + j + 4, hi);
+    }
+    if (j < n)
+        l2sq_batch<float>(a, b + j, ld, n - j, dim, out + j);
+}
+#endif
+} // namespace detail
+
 struct L1
 {
     template <class T>
@@ -37,6 +152,17 @@ struct L1
             d += a[i] - b[i];
         return d;
     }
+
+    template <class T>
+    inline void batch(const T* a, const T* b, std::size_t ld,
+        std::size_t n, int dim, double* out) const
+    {
+        for (std::size_t j = 0; j < n; j++)
+            out[j] = 0;
+        for (int k = 0; k < dim; k++)
+            for (std::size_t j = 0; j < n; j++)
+                out[j] += b[k * ld + j] - a[k];
+    }
 };
 
 struct L2
@@ -49,6 +175,20 @@ struct L2
             d += (a[i] - b[i]) * (a[i] - b[i]);
         return std::sqrt(d);
     }
+
+    template <class T>
+    inline void batch(const T* a, const T* b, std::size_t ld,
+        std::size_t n, int dim, double* out) const
+    {
+        detail::l2sq_batch(a, b, ld, n, dim, out);
+        for (std::size_t j = 0; j < n; j++)
+            out[j] = std::sqrt(out[j]);
+    }
+
+    inline double bound(double d) const
+    {
+        return d;
+    }
 };
 
 struct L2Sq
@@ -61,6 +201,18 @@ struct L2Sq
             d += (a[i] - b[i]) * (a[i] - b[i]);
         return d;
     }
+
+    template <class T>
+    inline void batch(const T* a, const T* b, std::size_t ld,
+        std::size_t n, int dim, double* out) const
+    {
+        detail::l2sq_batch(a, b, ld, n, dim, out);
+    }
+
+    inline double bound(double d) const
+    {
+        return std::sqrt(d);
+    }
 };
 
 struct Inf
@@ -76,6 +228,22 @@ struct Inf
         }
         return d;
     }
+
+    template <class T>
+    inline void batch(const T* a, const T* b, std::size_t ld,
+        std::size_t n, int dim, double* out) const
+    {
+        for (std::size_t j = 0; j < n; j++)
+            out[j] = 0;
+        for (int k = 0; k < dim; k++)
+        {
+            for (std::size_t j = 0; j < n; j++)
+            {
+                const auto t = b[k * ld + j] - a[k];
+                if (out[j] < t) out[j] = t;
+            }
+        }
+    }
 };
 } // namespace metrics
 } // namespace msc
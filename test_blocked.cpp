@@ -0,0 +1,88 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "msc"
+#include "test_common.h"
+
+#include <array>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+
+typedef double Scalar;
+typedef std::array<Scalar, 3> Container;
+
+// Clusters a point file out of core, in blocks, with and without keeping the
+// block indices, and checks the labels and the modes against an in-memory run
+// with bin seeding.
+int main()
+{
+    const auto points = mixture<Scalar, 3>(2000, 6, 0.5, 8, 2);
+    const std::string path = "test_blocked.mscp";
+    msc::write_points<Scalar>(path, points.begin(), points.end(), 3);
+    const msc::metrics::L2Sq metric;
+    const msc::kernels::ParabolicSq kernel;
+    const msc::estimators::Constant estimator(1);
+    msc::Options options;
+    options.bin_seeding = true;
+    const auto expected = msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), 3, metric, kernel, estimator,
+        options, msc::neighbors::KDTree());
+    const auto expected_labels = cluster_labels(expected, points.size());
+
+    bool ok = true;
+    {
+        const msc::MappedPoints<Scalar> mapped(path);
+        options.block_size = 300;
+        for (std::size_t cached : {std::size_t(1) << 22, std::size_t(0)})
+        {
+            options.cached_points = cached;
+            std::vector<std::size_t> labels(points.size(), points.size());
+            const auto modes = msc::mean_shift_cluster_blocked<Scalar>(
+                mapped.begin(), mapped.end(), mapped.dim(), metric, kernel,
+                estimator, options,
+                [&](std::size_t first, const std::uint32_t* values,
+                std::size_t n)
+                {
+                    for (std::size_t i = 0; i < n; i++)
+                        labels[first + i] = values[i];
+                },
+                msc::neighbors::KDTree());
+            std::cerr << "Modes: " << modes.size() << " in blocks, "
+                << expected.size() << " in memory" << std::endl;
+            std::vector<std::size_t> map;
+            if (!same_partition(labels, modes.size(), expected_labels,
+                expected.size(), map))
+            {
+                ok = false;
+                continue;
+            }
+            for (std::size_t c = 0; c < modes.size(); c++)
+                for (int k = 0; k < 3; k++)
+                    if (std::abs(modes[c][k] - expected[map[c]].mode[k]) > 1e-6)
+                        ok = false;
+        }
+    }
+    std::remove(path.c_str());
+    std::cerr << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
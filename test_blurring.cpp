@@ -0,0 +1,61 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "msc"
+#include "test_common.h"
+
+#include <array>
+#include <vector>
+#include <iostream>
+
+typedef double Scalar;
+typedef std::array<Scalar, 2> Container;
+
+// Checks that blurring mean shift groups a mixture of well separated blobs as
+// the usual form does. Only the partitions are compared: the blurring form
+// contracts the blobs themselves, so its modes differ.
+int main()
+{
+    const auto points = mixture<Scalar, 2>(400, 4, 0.5, 8, 3);
+    const msc::metrics::L2Sq metric;
+    const msc::kernels::GaussianSq kernel;
+    const msc::estimators::Constant estimator(1);
+    msc::Options options;
+    options.epsilon = 1e-8;
+    const auto clusters = msc::blurring_mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), 2, metric, kernel, estimator,
+        options);
+    const auto expected = msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), 2, metric, kernel, estimator,
+        options, msc::neighbors::Linear());
+
+    std::cerr << "Clusters: " << clusters.size() << " blurring, "
+        << expected.size() << " usual" << std::endl;
+    std::vector<std::size_t> map;
+    if (!same_partition(cluster_labels(clusters, points.size()),
+        clusters.size(), cluster_labels(expected, points.size()),
+        expected.size(), map))
+    {
+        std::cerr << "FAILED" << std::endl;
+        return 1;
+    }
+    std::cerr << "OK" << std::endl;
+    return 0;
+}
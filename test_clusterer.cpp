@@ -0,0 +1,66 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "msc"
+#include "test_common.h"
+
+#include <array>
+#include <vector>
+#include <iostream>
+
+typedef double Scalar;
+typedef std::array<Scalar, 2> Container;
+
+// Inserts and removes points through a Clusterer and checks its clusters
+// against those of a run from scratch on the points that are left.
+int main()
+{
+    const auto points = mixture<Scalar, 2>(600, 4, 0.5, 8, 1);
+    const msc::metrics::L2Sq metric;
+    const msc::kernels::ParabolicSq kernel;
+    const msc::estimators::Constant estimator(1);
+    auto clusterer = msc::make_clusterer<Scalar>(2, metric, kernel,
+        estimator, msc::Options(), msc::neighbors::KDTree());
+    clusterer.insert(points.begin(), points.begin() + 400);
+    clusterer.insert(points.begin() + 400, points.end());
+    std::vector<std::size_t> removed;
+    for (std::size_t i = 0; i < points.size(); i += 7)
+        removed.push_back(i);
+    const auto clusters = clusterer.remove(removed);
+
+    std::vector<Container> left;
+    for (std::size_t i = 0; i < points.size(); i++)
+        if (i % 7 != 0)
+            left.push_back(points[i]);
+    const auto expected = msc::mean_shift_cluster<Scalar>(
+        left.begin(), left.end(), 2, metric, kernel, estimator,
+        msc::Options(), msc::neighbors::KDTree());
+
+    std::cerr << "Clusters: " << clusters.size() << " incremental, "
+        << expected.size() << " from scratch" << std::endl;
+    if (clusterer.size() != left.size() ||
+        !same_clusters(clusters, expected, left.size(), 1e-4))
+    {
+        std::cerr << "FAILED" << std::endl;
+        return 1;
+    }
+    std::cerr << "OK" << std::endl;
+    return 0;
+}
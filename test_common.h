@@ -0,0 +1,104 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include "msc.h"
+
+#include <array>
+#include <cmath>
+#include <random>
+#include <vector>
+
+// Helpers of the example checks.
+
+// `n` points of `D` dimensions drawn in turn from `blobs` Gaussian blobs of
+// deviation `spread`, centered on the corners of a grid of side `gap`.
+template <class T, std::size_t D>
+inline std::vector<std::array<T, D>> mixture(std::size_t n, int blobs,
+    double spread, double gap, unsigned seed)
+{
+    std::mt19937 random(seed);
+    std::normal_distribution<double> normal(0, spread);
+    std::vector<std::array<T, D>> points(n);
+    for (std::size_t i = 0; i < n; i++)
+    {
+        auto c = static_cast<int>(i % blobs);
+        for (std::size_t k = 0; k < D; k++, c /= 2)
+            points[i][k] = static_cast<T>(gap * (c % 2) + normal(random));
+    }
+    return points;
+}
+
+// Cluster of each of the `n` points, or the number of clusters for points in
+// none.
+template <class T>
+inline std::vector<std::size_t> cluster_labels(
+    const std::vector<msc::Cluster<T>>& clusters, std::size_t n)
+{
+    std::vector<std::size_t> labels(n, clusters.size());
+    for (std::size_t c = 0; c < clusters.size(); c++)
+        for (auto i : clusters[c].members)
+            labels[i] = c;
+    return labels;
+}
+
+// Whether two labelings of the same points, with `ma` and `mb` labels, group
+// them alike; `map` receives the label in `b` of every label in `a`.
+inline bool same_partition(const std::vector<std::size_t>& a, std::size_t ma,
+    const std::vector<std::size_t>& b, std::size_t mb,
+    std::vector<std::size_t>& map)
+{
+    if (a.size() != b.size() || ma != mb)
+        return false;
+    map.assign(ma, mb);
+    std::vector<std::size_t> inverse(mb, ma);
+    for (std::size_t i = 0; i < a.size(); i++)
+    {
+        if (a[i] >= ma || b[i] >= mb)
+            return false;
+        if (map[a[i]] == mb && inverse[b[i]] == ma)
+        {
+            map[a[i]] = b[i];
+            inverse[b[i]] = a[i];
+        }
+        else if (map[a[i]] != b[i])
+            return false;
+    }
+    return true;
+}
+
+// Whether both clusterings group the `n` points alike, with modes within
+// `tolerance` of each other in every coordinate.
+template <class T>
+inline bool same_clusters(const std::vector<msc::Cluster<T>>& a,
+    const std::vector<msc::Cluster<T>>& b, std::size_t n, double tolerance)
+{
+    std::vector<std::size_t> map;
+    if (!same_partition(cluster_labels(a, n), a.size(),
+        cluster_labels(b, n), b.size(), map))
+        return false;
+    for (std::size_t c = 0; c < a.size(); c++)
+        for (std::size_t k = 0; k < a[c].mode.size(); k++)
+            if (std::abs(static_cast<double>(a[c].mode[k]) -
+                static_cast<double>(b[map[c]].mode[k])) > tolerance)
+                return false;
+    return true;
+}
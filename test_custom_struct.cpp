@@ -46,6 +46,8 @@ namespace msc
 template <class T>
 struct Accessor<T, Point3<T>>
 {
+    static const int dim = 3;
+
     inline static const T* data(const Point3<T>& container)
     {
         return &container.x;
@@ -72,7 +74,6 @@ int main()
     const auto t0 = std::chrono::high_resolution_clock::now();
     const auto clusters = msc::mean_shift_cluster<Scalar>(
         std::begin(points), std::end(points),
-        sizeof(Container) / sizeof(Scalar),
         msc::metrics::L2Sq(),
         msc::kernels::ParabolicSq(),
         msc::estimators::Constant(bandwidth));
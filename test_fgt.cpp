@@ -0,0 +1,60 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "msc"
+#include "test_common.h"
+
+#include <array>
+#include <vector>
+#include <iostream>
+
+typedef double Scalar;
+typedef std::array<Scalar, 2> Container;
+
+// Checks the fast Gauss transform against exact sums over a linear scan on a
+// mixture of Gaussian blobs. The transform must take over the sums (no kernel
+// is evaluated point by point) and find the same groups, with modes close to
+// the exact ones.
+int main()
+{
+    const auto points = mixture<Scalar, 2>(10000, 4, 0.5, 6, 5);
+    const msc::metrics::L2Sq metric;
+    const msc::kernels::GaussianSq kernel;
+    const msc::estimators::Constant estimator(1);
+    msc::Options options;
+    options.epsilon = 1e-10;
+    options.max_iter = 500;
+    const auto expected = msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), 2, metric, kernel, estimator,
+        options, msc::neighbors::Linear());
+    msc::Stats stats;
+    const auto clusters = msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), 2, metric, kernel, estimator,
+        options, msc::neighbors::FGT(1e-6), stats);
+
+    std::cerr << "Clusters: " << clusters.size() << " transform, "
+        << expected.size() << " exact" << std::endl;
+    std::cerr << "Kernel evaluations: " << stats.counters().evaluations
+        << std::endl;
+    const bool ok = stats.counters().evaluations == 0 &&
+        same_clusters(clusters, expected, points.size(), 1e-3);
+    std::cerr << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
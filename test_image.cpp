@@ -0,0 +1,73 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "msc"
+#include "msc"
+#include "test_common.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include <iostream>
+
+// Checks that image mean shift splits a synthetic image of four rectangles
+// of distinct colors, with a little noise, into one segment per rectangle,
+// each close to the color of its rectangle. The image spans more than one
+// tile, so the tiles must agree at their borders.
+int main()
+{
+    const int width = 96, height = 80, channels = 3;
+    const int colors[4][3] = {
+        {200, 40, 40}, {40, 200, 40}, {40, 40, 200}, {200, 200, 40}};
+    std::mt19937 random(11);
+    std::uniform_int_distribution<int> noise(-4, 4);
+    std::vector<std::uint8_t> pixels(width * height * channels);
+    std::vector<std::size_t> regions(width * height);
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const int p = y * width + x;
+            const int r = (x < 56 ? 0 : 1) + (y < 30 ? 0 : 2);
+            regions[p] = r;
+            for (int c = 0; c < channels; c++)
+                pixels[p * channels + c] =
+                    static_cast<std::uint8_t>(colors[r][c] + noise(random));
+        }
+    }
+
+    msc::Options options;
+    options.epsilon = 1e-3;
+    const auto result = msc::mean_shift_image(pixels.data(), width, height,
+        channels, msc::kernels::Uniform(), 4.0, 20.0, options);
+
+    std::cerr << "Segments: " << result.segment_count() << std::endl;
+    std::vector<std::size_t> map;
+    bool ok = same_partition(result.labels, result.segment_count(), regions,
+        4, map);
+    for (std::size_t s = 0; ok && s < map.size(); s++)
+        for (int c = 0; c < channels; c++)
+            if (std::abs(static_cast<int>(result.segments[s * channels + c]) -
+                colors[map[s]][c]) > 2)
+                ok = false;
+    std::cerr << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
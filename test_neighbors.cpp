@@ -0,0 +1,73 @@
+// Copyright (c) 2017 Francisco Troncoso Pastoriza
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include "msc"
+#include "test_common.h"
+
+#include <array>
+#include <vector>
+#include <string>
+#include <iostream>
+
+typedef double Scalar;
+typedef std::array<Scalar, 8> Container;
+
+template <class Neighbors>
+bool check(const std::string& name, const std::vector<Container>& points,
+    const std::vector<msc::Cluster<Scalar>>& expected, Neighbors neighbors,
+    double tolerance);
+
+// Checks the k-d tree and LSH backends against a linear scan on a mixture of
+// well separated blobs in 8 dimensions: the k-d tree must find the same
+// modes, and LSH, which only finds approximate neighbors, the same groups.
+int main()
+{
+    const auto points = mixture<Scalar, 8>(1000, 8, 0.5, 10, 4);
+    const auto expected = msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), 8, msc::metrics::L2Sq(),
+        msc::kernels::ParabolicSq(), msc::estimators::Constant(5),
+        msc::Options(), msc::neighbors::Linear());
+    std::cerr << "Clusters: " << expected.size() << " linear" << std::endl;
+    const bool ok =
+        check("k-d tree", points, expected, msc::neighbors::KDTree(), 1e-9) &
+        check("LSH", points, expected, msc::neighbors::LSH(8, 6, 1), -1);
+    std::cerr << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
+
+// Compares the clusters found with a backend with the expected ones; with a
+// negative tolerance only the partitions are compared.
+template <class Neighbors>
+bool check(const std::string& name, const std::vector<Container>& points,
+    const std::vector<msc::Cluster<Scalar>>& expected, Neighbors neighbors,
+    double tolerance)
+{
+    const auto clusters = msc::mean_shift_cluster<Scalar>(
+        points.begin(), points.end(), 8, msc::metrics::L2Sq(),
+        msc::kernels::ParabolicSq(), msc::estimators::Constant(5),
+        msc::Options(), neighbors);
+    std::cerr << "Clusters: " << clusters.size() << " " << name << std::endl;
+    if (tolerance >= 0)
+        return same_clusters(clusters, expected, points.size(), tolerance);
+    std::vector<std::size_t> map;
+    return same_partition(cluster_labels(clusters, points.size()),
+        clusters.size(), cluster_labels(expected, points.size()),
+        expected.size(), map);
+}